@@ -8,7 +8,9 @@ module AddressDecoder_Verilog (
 		output reg DMASelect_L,
 		output reg GraphicsCS_L,
 		output reg OffBoardMemory_H,
-		output reg CanBusSelect_H
+		output reg CanBusSelect_H,
+		output reg BistSelect_H,
+		output reg PerfSelect_H
 );
 
 	always@(*) begin
@@ -23,6 +25,8 @@ module AddressDecoder_Verilog (
 		GraphicsCS_L <= 1 ;
 		OffBoardMemory_H <= 0;
 		CanBusSelect_H <= 0;
+		BistSelect_H <= 0;
+		PerfSelect_H <= 0;
 		
 		// overriddent value
 	
@@ -43,6 +47,22 @@ module AddressDecoder_Verilog (
 		// 
 		if(Address[31:26] == 6'b0000_10) // address hex 0800 0000 - 0bff ffff	0000 1000 0000 0000 0000 0000 0000 0000 to 0000 1011 1111 1111 1111 1111 1111 1111
 			DramSelect_H <= 1;
+
+		// uncached alias of the same dram, the dram controller ignores address bit 26 and the cache controller
+		// uses it to bypass the cache
+		//
+		if(Address[31:26] == 6'b0000_11) // address hex 0c00 0000 - 0fff ffff
+			DramSelect_H <= 1;
+
+		// memory BIST registers
+		//
+		if(Address[31:6] == 26'h0010204) // address hex 0040 8100 - 0040 813F
+			BistSelect_H <= 1;
+
+		// dram controller performance counters
+		//
+		if(Address[31:6] == 26'h0010202) // address hex 0040 8080 - 0040 80BF
+			PerfSelect_H <= 1;
 		
 		
 		
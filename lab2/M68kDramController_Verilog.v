@@ -1,8 +1,59 @@
 //////////////////////////////////////////////////////////////////////////////////////-
-// Simple DRAM controller for the DE1 board, assuming a 50MHz controller/memory clock
+// Simple DRAM controller for the DE1 board, clock defaults to 50MHz controller/memory clock
 // Assuming 64Mbytes SDRam organised as 32Meg x16 bits with 8192 rows (13 bit row addr
 // 1024 columns (10 bit column address) and 4 banks (2 bit bank address)
-// CAS latency is 2 clock periods
+//
+// SDRAM timings are parameters in ns, the clock counts for each are worked out from
+// ClockFrequencyMHz when the design is compiled, so the controller can be rebuilt for a
+// faster clock by changing the parameters only. CASLatency (2 or 3) is programmed into the
+// mode register and sets the read data wait
+//
+// Rows are left open after each access (page mode). The controller remembers the open
+// row in each of the 4 banks so an access to the same row goes straight to the column
+// command. A bank is only precharged on a row conflict, or all banks before a refresh
+//
+// BankMapping parameter selects how the 68k address is split into bank/row/column
+// (column is always Address[10:1])
+//		0 = linear:       bank = Address[25:24], row = Address[23:11]
+//		1 = interleaved:  bank = Address[12:11], row = Address[25:13]  (consecutive 2K rows rotate through the banks)
+//		2 = XOR hashed:   bank = Address[25:24] ^ Address[12:11], row = Address[23:11]
+// 1 and 2 spread sequential code/data and the stack/heap over all 4 banks so their rows can stay open together
+//
+// Reads use a burst of LineWords (4 or 8) words. The word the 68000 asked for comes first
+// and is given to the CPU as normal, the rest of the burst is latched into a line buffer.
+// A later read that hits the line buffer gets its data and Dtack without any SDRAM command.
+// A bus cycle the 68000 starts while the burst is still arriving waits for the fill to end
+// Writes are still single word (mode register A9 = 1) and invalidate the line if they hit it
+//
+// Byte writes use the SDRAM's DQM byte masks: SDram_DQM[1] (UDQM) masks data bits 15-8 and
+// SDram_DQM[0] (LDQM) masks bits 7-0, so a byte store is a single write that leaves the other byte alone
+//
+// Writes are posted: the 68000's address, data and byte strobes go into a WriteQueueDepth
+// entry queue (4 or 8) and Dtack is given straight away. The queue is drained to the SDRAM
+// when the controller has nothing else to do, when it is full, or when a read needs an older
+// write to reach the SDRAM first. A write to an address already queued is merged into that
+// entry, and a read of a queued address gets the queued data if it covers the bytes read
+// A memory BIST read (BistAccess_H) skips the queue and the line buffer: the queue is drained
+// first and the data always comes from the SDRAM, so the test sees what the memory holds
+//
+// Each bank has its own timers for tRCD (activate to read/write) and tRAS/tWR/tRP (when it can next be
+// precharged or activated), so commands to one bank only wait for that bank. While a read burst or a
+// queued write is using the data lines, the bank needed by the next queued write is activated (or its
+// wrong row precharged) in the otherwise idle command slots, so back to back drains and line fills to
+// different banks overlap the row opening with the data transfer
+//
+// Refresh is scheduled with a credit counter. Every 7.5us another refresh is owed, but it is
+// only forced once MaxPostponedRefreshes are owed. Otherwise refreshes are done when the
+// controller has been idle for IdleRefreshDelay clocks, up to MaxEarlyRefreshes ahead of time
+//
+// Performance counters (32 bit, read as two 16 bit words) at hex 0040 8080 - 0040 80BF
+//		8080 + 4*n	Counter n bits 31-16, counter n bits 15-0
+//			n = 0 clock cycles, 1 CPU reads, 2 CPU writes, 3 bank activates, 4 row hits,
+//			    5 row conflicts, 6 cycles the CPU waited for a refresh, 7 cycles the CPU waited for Dtack
+//		80A0	Control (write): bit 0 = clear all counters, bit 1 = count enable
+//				Status  (read) : bit 1 = count enable
+// PerfSelect_H comes from the address decoder and PerfDataOut goes onto the 68k data in bus when it is active.
+// Counters should be stopped before they are read so the two halves match
 //
 // designed to work with 68000 cpu using 16 bit data bus and 32 bit address bus
 // separate upper and lower data stobes for individual byte and 16 bit word access
@@ -29,19 +80,33 @@ module M68kDramController_Verilog (
 			output reg SDram_WE_L,								// active low Write enable for dram chip
 			output reg unsigned [12:0] SDram_Addr,			// 13 bit address bus dram chip	
 			output reg unsigned [1:0] SDram_BA,				// 2 bit bank address
-			inout  reg unsigned [15:0] SDram_DQ,			// 16 bit bi-directional data lines to dram chip
+			inout  unsigned [15:0] SDram_DQ,				// 16 bit bi-directional data lines to dram chip
 			
 			output reg Dtack_L,									// Dtack back to CPU at end of bus cycle
 			output reg ResetOut_L,								// reset out to the CPU
 	
 			// Use only if you want to simulate dram controller state (e.g. for debugging)
-			output reg [4:0] DramState
+			output reg [4:0] DramState,
+
+			// handshake for a bus master other than the 68000 (e.g. the memory BIST)
+			output reg Ready_H,									// controller idle, a new access may be started
+			output reg AccessDone_H,							// access finished, read data is on DataOut or the write has been taken
+			input BistAccess_H,									// access is from the memory BIST, reads must come from the SDRAM itself
+
+			// performance counter registers
+			input PerfSelect_H,									// active high when the 68000 is accessing the counters
+			output reg unsigned [15:0] PerfDataOut,			// counter data back to the 68000
+
+			output reg unsigned [1:0] SDram_DQM				// byte masks for the dram chip, bit 1 = upper byte, high masks the byte during a write
 		); 	
 		
 		// WIRES and REGs
 		
 		reg  	[4:0] Command;										// 5 bit signal containing Dram_CKE_H, SDram_CS_L, SDram_RAS_L, SDram_CAS_L, SDram_WE_L
 
+		reg 	unsigned	[15:0] SDramDQOut;					// registered data out to the SDRAM data lines, Z unless writing
+		assign SDram_DQ = SDramDQOut;
+
 		reg	TimerLoad_H ;										// logic 1 to load Timer on next clock
 		reg   TimerDone_H ;										// set to logic 1 when timer reaches 0
 		reg 	unsigned	[15:0] Timer;							// 16 bit timer value
@@ -52,6 +117,43 @@ module M68kDramController_Verilog (
 		reg 	unsigned	[15:0] RefreshTimer;					// 16 bit refresh timer value
 		reg 	unsigned	[15:0] RefreshTimerValue;			// 16 bit refresh timer preload value
 
+		// SDRAM timing, all times in ns
+		parameter ClockFrequencyMHz = 50;						// controller/SDRAM clock
+		parameter CASLatency = 2;									// clocks from read command to data, 2 or 3
+		parameter tPowerUp_ns = 100000;							// power up delay before the first command
+		parameter tRP_ns = 20;										// precharge to activate/refresh (18ns min)
+		parameter tRCD_ns = 20;										// activate to read/write (18ns min)
+		parameter tRFC_ns = 70;										// refresh to next command (60ns min)
+		parameter tRAS_ns = 42;										// activate to precharge
+		parameter tWR_ns = 15;										// write to precharge
+		parameter tREFI_ns = 7500;									// interval between refreshes (64ms / 8192 rows = 7.8us max)
+
+		// clock counts, rounded up, except the refresh interval which is rounded down so we refresh early rather than late
+		localparam PowerUpClocks = (tPowerUp_ns * ClockFrequencyMHz + 999) / 1000;
+		localparam TrpClocks = (tRP_ns * ClockFrequencyMHz + 999) / 1000;
+		localparam TrcdClocks = (tRCD_ns * ClockFrequencyMHz + 999) / 1000;
+		localparam TrfcClocks = (tRFC_ns * ClockFrequencyMHz + 999) / 1000;
+		localparam TrasClocks = (tRAS_ns * ClockFrequencyMHz + 999) / 1000;
+		localparam TwrClocks = (tWR_ns * ClockFrequencyMHz + 999) / 1000;
+		localparam RefreshClocks = (tREFI_ns * ClockFrequencyMHz) / 1000;
+
+		// Timer values for the wait states, a wait state is left once the Timer reaches 0
+		localparam TrpWait = (TrpClocks > 2) ? TrpClocks - 2 : 0;		// precharge, wait state(s), then activate/refresh
+		localparam TrcdWait = (TrcdClocks > 1) ? TrcdClocks - 1 : 0;	// activate, then read/write from the waiting state
+		localparam TrfcWait = (TrfcClocks > 2) ? TrfcClocks - 2 : 0;	// refresh, wait state(s), then next command
+		localparam [2:0] CASLatencyCode = CASLatency;					// mode register A6-A4
+
+		parameter InitialRefreshes = 10;							// auto refreshes during initialisation
+
+		// refresh scheduling
+		parameter MaxPostponedRefreshes = 8;					// refresh is forced once this many are owed (SDRAM allows 8)
+		parameter MaxEarlyRefreshes = 8;						// refreshes that may be done ahead of time (SDRAM allows 8)
+		parameter IdleRefreshDelay = 16;						// idle clocks before an early refresh is done
+
+		reg	RefreshRunning_H;									// refresh timer started at the end of initialisation
+		reg	signed [4:0] RefreshOwed;							// refreshes owed to the SDRAM, negative when done early
+		reg	unsigned [7:0] IdleCycles;							// clocks the controller has had nothing to do
+
 		reg   unsigned [4:0] CurrentState;					// holds the current state of the dram controller
 		reg   unsigned [4:0] NextState;						// holds the next state of the dram controller
 		
@@ -60,14 +162,130 @@ module M68kDramController_Verilog (
 		
 		reg	DramDataLatch_H;									// used to indicate that data from SDRAM should be latched and held for 68000 after the CAS latency period
 		reg  	unsigned [15:0]SDramWriteData;
+		reg  	unsigned [1:0] DramDQM;								// byte masks to go out with the command
 		
 		reg  FPGAWritingtoSDram_H;								// When '1' enables FPGA data out lines leading to SDRAM to allow writing, otherwise they are set to Tri-State "Z"
 		reg  CPU_Dtack_L;											// Dtack back to CPU
 		reg  CPUReset_L;
 
-		reg  [6:0]counter;
+		reg  [6:0]counter;										// initial auto refreshes done
 		reg  [3:0]nopCounter;
 
+		// open row (page mode) tracking, one entry per bank
+		reg  unsigned [3:0] OpenRowValid;					// bit n set when bank n has a row open
+		reg  unsigned [12:0] OpenRow [0:3];				// the row open in each bank
+		reg  OpenRowLoad_H;										// record the row being activated by the CPU's address
+		reg  OpenRowClearAll_H;									// all banks are being precharged
+
+		reg  OpenRowLoadDrain_H;								// record the row being activated for the write queue
+		reg  OpenRowLoadLook_H;									// record the row activated ahead of time for the next queued write
+		reg  OpenRowClearLook_H;								// the next queued write's bank is being precharged
+
+		// per bank timing, counted from the commands sent to each bank
+		reg  unsigned [3:0] BankColTimer [0:3];				// clocks until bank n can take a read/write (tRCD)
+		reg  unsigned [3:0] BankRowTimer [0:3];				// clocks until bank n can be precharged (tRAS, tWR) or activated (tRP)
+		integer b;
+
+		wire unsigned [3:0] BankColReady_H = {BankColTimer[3] == 0, BankColTimer[2] == 0, BankColTimer[1] == 0, BankColTimer[0] == 0};
+		wire unsigned [3:0] BankRowReady_H = {BankRowTimer[3] == 0, BankRowTimer[2] == 0, BankRowTimer[1] == 0, BankRowTimer[0] == 0};
+
+		parameter BankMapping = 0;								// see header, 0 = linear, 1 = interleaved, 2 = XOR hashed
+
+		// split a 68k address into bank and row according to BankMapping
+
+		function [1:0] MapBank;
+			input [25:0] A;
+			MapBank = (BankMapping == 1) ? A[12:11] :
+						 (BankMapping == 2) ? (A[25:24] ^ A[12:11]) : A[25:24];
+		endfunction
+
+		function [12:0] MapRow;
+			input [25:0] A;
+			MapRow = (BankMapping == 1) ? A[25:13] : A[23:11];
+		endfunction
+
+		wire unsigned [1:0] CpuBank = MapBank(Address[25:0]);
+		wire unsigned [12:0] CpuRow = MapRow(Address[25:0]);
+		wire RowOpen_H = OpenRowValid[CpuBank];
+		wire RowHit_H = RowOpen_H & (OpenRow[CpuBank] == CpuRow);
+
+		wire CpuRead_H = (DramSelect_L == 0 && AS_L == 0 && WE_L == 1);
+		wire CpuWrite_H = (DramSelect_L == 0 && AS_L == 0 && WE_L == 0);
+		wire CpuShortcut_H = ~BistAccess_H;										// read may be answered from the write queue or line buffer
+
+		// posted write queue, a circular buffer of entries from WqHead (oldest) to WqTail (next free)
+		parameter WriteQueueDepth = 4;							// entries, 4 or 8
+
+		reg  unsigned [24:0] WqAddress [0:7];					// Address[25:1] of each queued write
+		reg  unsigned [15:0] WqData [0:7];						// data for each queued write
+		reg  unsigned [7:0] WqUpper;								// bit n set when entry n writes data bits 15-8
+		reg  unsigned [7:0] WqLower;								// bit n set when entry n writes data bits 7-0
+		reg  unsigned [7:0] WqValid;								// bit n set when entry n is waiting to be written
+		reg  unsigned [2:0] WqHead;
+		reg  unsigned [2:0] WqTail;
+		reg  WqPush_H;												// queue (or merge) the CPU's write
+		reg  WqPop_H;												// head entry has been written to the SDRAM
+		reg  WqForward_H;											// give the CPU its read data from the queue
+
+		reg  WqMatch_H;											// the CPU's address is in the queue
+		reg  unsigned [2:0] WqMatchIndex;						// and this is the entry
+		integer i;
+
+		wire WqFull_H = WqValid[WqTail];
+		wire WqEmpty_H = ~WqValid[WqHead];
+		wire WqCovered_H = WqMatch_H & (UDS_L | WqUpper[WqMatchIndex]) & (LDS_L | WqLower[WqMatchIndex]);	// queued entry has every byte the CPU is reading
+		wire ReadQueueClear_H = BistAccess_H ? WqEmpty_H : ~WqMatch_H;		// a CPU read waits for a queued write to its address, a BIST read for the whole queue
+
+		wire unsigned [25:0] DrainAddress = {WqAddress[WqHead], 1'b0};	// address of the oldest queued write
+		wire unsigned [1:0] DrainBank = MapBank(DrainAddress);
+		wire unsigned [12:0] DrainRow = MapRow(DrainAddress);
+		wire DrainRowOpen_H = OpenRowValid[DrainBank];
+		wire DrainRowHit_H = DrainRowOpen_H & (OpenRow[DrainBank] == DrainRow);
+
+		reg  unsigned [1:0] BurstBank;							// bank the line buffer is being filled from
+
+		wire RefreshTick_H = RefreshTimerDone_H & RefreshRunning_H;				// another 7.5us gone, one more refresh owed
+		wire RefreshForced_H = (RefreshOwed >= MaxPostponedRefreshes);			// can't put it off any longer
+		wire RefreshEarly_H = (IdleCycles >= IdleRefreshDelay) && (RefreshOwed > -MaxEarlyRefreshes);
+
+		// performance counters
+		parameter PerfCycles = 3'd0;
+		parameter PerfReads = 3'd1;
+		parameter PerfWrites = 3'd2;
+		parameter PerfActivates = 3'd3;
+		parameter PerfRowHits = 3'd4;
+		parameter PerfRowConflicts = 3'd5;
+		parameter PerfRefreshStalls = 3'd6;
+		parameter PerfDtackWaits = 3'd7;
+
+		reg  unsigned [31:0] PerfCount [0:7];
+		reg  PerfEnable_H;										// counters running
+		reg  PerfAccessCounted_H;								// this CPU bus cycle has been counted as a read or write
+		integer n;
+
+		// read line buffer, filled by a burst read
+		parameter LineWords = 4;									// words per read burst/line, 4 or 8
+
+		reg  unsigned [15:0] LineData [0:7];					// buffered words, only the first LineWords are used
+		reg  unsigned [24:0] LineBase;							// Address[25:1] of the first word in the line
+		reg  LineValid_H;											// line buffer holds valid data
+		reg  unsigned [2:0] FillWord;							// word in the line the next burst word goes to
+		reg  unsigned [2:0] BurstCount;						// words of the burst latched so far
+		reg  LineFillStart_H;									// a burst read is being issued for the CPU's address
+		reg  LineCapture_H;										// latch the current burst word into the line
+		reg  LineFillDone_H;										// last burst word latched, line is valid
+		reg  LineInvalidate_H;									// CPU is writing to the buffered line
+		reg  LineHitLoad_H;										// give the CPU its data from the line buffer
+		reg  ReadCycleEnded_H;									// CPU's read finished while the rest of the burst is still arriving
+
+		wire unsigned [24:0] CpuLineBase = Address[25:1] & ~(LineWords - 1);
+		wire unsigned [24:0] DrainLineBase = DrainAddress[25:1] & ~(LineWords - 1);
+		wire unsigned [2:0] CpuWordInLine = Address[3:1] & (LineWords - 1);
+		wire LineHit_H = LineValid_H & (CpuLineBase == LineBase);
+		wire CpuStrobe_H = (UDS_L == 0 || LDS_L == 0);
+		wire ReadDtack_H = CpuStrobe_H & ~ReadCycleEnded_H;			// Dtack for the read that started the burst, never for a later bus cycle
+		wire unsigned [2:0] BurstLengthCode = (LineWords == 8) ? 3'b011 : 3'b010;	// mode register A2-A0
+
 		// 5 bit Commands to the SDRam
 
 		parameter PoweringUp = 5'b00000 ;					// take CKE & CS low during power up phase, address and bank address = dont'care
@@ -114,16 +332,35 @@ module M68kDramController_Verilog (
 		parameter AutorefreshNop = 5'h0C;
 		parameter AutorefreshState = 5'h0D;
 		parameter AutorefreshNopCycle = 5'h0E;
-		parameter LoadRefreshTimer = 5'h0F;
 
-		parameter WriteDram = 5'h10;
-		parameter WriteDramWait = 5'h11;
+		parameter WriteDram = 5'h10;						// put the CPU's write in the write queue
 
 		parameter ReadDram = 5'h12;
 		parameter ReadDramWait = 5'h13;
 
 		parameter CpuWait = 5'h14;
 
+		parameter PrechargeConflictNop = 5'h15;			// row conflict: bank precharged, wait tRP
+		parameter ActivateRow = 5'h16;						// row conflict: open the new row
+
+		parameter ReadBurstFill = 5'h17;					// latch the rest of the read burst into the line buffer
+
+		parameter DrainPrechargeNop = 5'h18;				// write queue row conflict: bank precharged, wait tRP
+		parameter DrainActivate = 5'h19;					// open the row for the oldest queued write
+		parameter DrainWrite = 5'h1A;						// write the oldest queued write to the SDRAM
+		parameter DrainWriteWait = 5'h1B;					// hold the write data, then take the entry off the queue
+
+		// bank lookahead on the next write to be drained (the one after the head while the head is being written)
+		wire unsigned [2:0] LookIndex = (CurrentState == DrainWriteWait) ? ((WqHead + 3'd1) & (WriteQueueDepth - 1)) : WqHead;
+		wire unsigned [25:0] LookAddress = {WqAddress[LookIndex], 1'b0};
+		wire unsigned [1:0] LookBank = MapBank(LookAddress);
+		wire unsigned [12:0] LookRow = MapRow(LookAddress);
+		wire LookRowHit_H = OpenRowValid[LookBank] & (OpenRow[LookBank] == LookRow);
+		wire LookBankBusy_H = ((CurrentState == ReadDramWait || CurrentState == ReadBurstFill) && LookBank == BurstBank) ||
+									 (CurrentState == DrainWriteWait && LookBank == DrainBank);
+		wire LookAhead_H = (CurrentState == ReadDramWait || CurrentState == ReadBurstFill || CurrentState == DrainWriteWait || CurrentState == CpuWait) &&
+								 WqValid[LookIndex] == 1 && LookRowHit_H == 0 && LookBankBusy_H == 0 && BankRowReady_H[LookBank] == 1;
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // General Timer for timing and counting things: Loadable and counts down on each clock then produced a TimerDone signal and stops counting
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -157,6 +394,37 @@ module M68kDramController_Verilog (
 		if(RefreshTimer == 16'd0) 								// if timer has counted down to 0
 			RefreshTimerDone_H <= 1 ;						// output '1' to indicate time has elapsed
 	end
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Refresh scheduler: count refreshes owed (each expiry of the refresh timer) against refreshes done (AutorefreshState),
+// and how long the controller has been idle so a refresh can be slipped in early
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	always@(posedge Clock, negedge Reset_L)
+	begin
+		if(Reset_L == 0) begin
+			RefreshRunning_H <= 0;
+			RefreshOwed <= 5'sd0;
+			IdleCycles <= 8'd0;
+		end
+		else begin
+			if(CurrentState == InitialLoadRefreshTimer) begin			// SDRAM has just been refreshed by the initialisation
+				RefreshRunning_H <= 1;
+				RefreshOwed <= 5'sd0;
+			end
+			else if(RefreshTick_H == 1 && CurrentState != AutorefreshState)
+				RefreshOwed <= RefreshOwed + 5'sd1;
+			else if(RefreshTick_H == 0 && CurrentState == AutorefreshState)
+				RefreshOwed <= RefreshOwed - 5'sd1;
+
+			if(CurrentState == IdleState && CpuRead_H == 0 && CpuWrite_H == 0 && WqEmpty_H == 1) begin
+				if(IdleCycles != 8'hFF)
+					IdleCycles <= IdleCycles + 8'd1;
+			end
+			else
+				IdleCycles <= 8'd0;
+		end
+	end
 	
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////-
 // concurrent process state registers
@@ -165,8 +433,11 @@ module M68kDramController_Verilog (
 
    always@(posedge Clock, negedge Reset_L)
 	begin
-		if(Reset_L == 0) 							// asynchronous reset
+		if(Reset_L == 0) begin					// asynchronous reset
 			CurrentState <= InitialisingState ;
+			Ready_H <= 0 ;
+			AccessDone_H <= 0 ;
+		end
 		
 		else 	begin									// state can change only on low-to-high transition of clock
 			CurrentState <= NextState;		
@@ -182,6 +453,7 @@ module M68kDramController_Verilog (
 			
 			SDram_Addr  <= DramAddress;		// output the row/column address to the dram
 			SDram_BA   	<= BankAddress;		// output the bank address to the dram
+			SDram_DQM  	<= DramDQM;				// output the byte masks to the dram
 
 			// signals back to the 68000
 
@@ -194,10 +466,12 @@ module M68kDramController_Verilog (
 			// of course during a write, the dram WE signal will need to be driven low and it will respond by tri-stating its outputs lines so you can drive data in to it
 			// remember the Dram chip has bi-directional data lines, when you read from it, it turns them on, when you write to it, it turns them off (tri-states them)
 			if(FPGAWritingtoSDram_H == 1) 			// if CPU is doing a write, we need to turn on the FPGA data out lines to the SDRam and present Dram with CPU data 
-				SDram_DQ	<= SDramWriteData ;
+				SDramDQOut	<= SDramWriteData ;
 			else
-				SDram_DQ	<= 16'bZZZZZZZZZZZZZZZZ;			// otherwise tri-state the FPGA data output lines to the SDRAM for anything other than writing to it
+				SDramDQOut	<= 16'bZZZZZZZZZZZZZZZZ;			// otherwise tri-state the FPGA data output lines to the SDRAM for anything other than writing to it
 				DramState <= CurrentState ;					// output current state - useful for debugging so you can see you state machine changing states etc
+				Ready_H <= (NextState == IdleState) ;		// registered from NextState so these line up with CurrentState
+				AccessDone_H <= (NextState == CpuWait) ;
 		end
 	end	
 
@@ -216,8 +490,231 @@ module M68kDramController_Verilog (
 	begin
 		if(DramDataLatch_H == 1)      			// asserted during the read operation
 			DataOut <= SDram_DQ ;					// store 16 bits of data regardless of width - don't worry about tri state since that will be handled by buffers outside dram controller
+		else if(WqForward_H == 1)					// read of an address still in the write queue
+			DataOut <= WqData[WqMatchIndex] ;
+		else if(LineHitLoad_H == 1)				// read hit in the line buffer
+			DataOut <= LineData[CpuWordInLine] ;
+
+		if(LineCapture_H == 1)						// each word of the burst goes into the line buffer, starting with the CPU's word
+			LineData[FillWord] <= SDram_DQ ;
+	end
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////-
+// Line buffer control: start a fill on a burst read, step through the line as the words arrive (wrapping like
+// the SDRAM's sequential burst does), mark it valid at the end, and throw it away if the CPU writes to it
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////-
+
+	always@(posedge Clock, negedge Reset_L)
+	begin
+		if(Reset_L == 0)
+			LineValid_H <= 0;
+		else if(LineFillStart_H == 1) begin
+			LineValid_H <= 0;
+			LineBase <= CpuLineBase;
+			BurstBank <= CpuBank;
+			FillWord <= CpuWordInLine;
+			BurstCount <= 3'd0;
+		end
+		else begin
+			if(LineCapture_H == 1) begin
+				FillWord <= (FillWord + 3'd1) & (LineWords - 1);
+				BurstCount <= BurstCount + 3'd1;
+			end
+
+			if(LineInvalidate_H == 1)
+				LineValid_H <= 0;
+			else if(LineFillDone_H == 1)
+				LineValid_H <= 1;
+		end
 	end
 	
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////-
+// Read cycle end: the 68000 can finish its read and start another bus cycle while the rest of the burst is being
+// latched, so remember that the strobes went high. The new cycle is then left alone until the controller is idle
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////-
+
+	always@(posedge Clock, negedge Reset_L)
+	begin
+		if(Reset_L == 0)
+			ReadCycleEnded_H <= 0;
+		else if(CurrentState == IdleState)
+			ReadCycleEnded_H <= 0;
+		else if((CurrentState == ReadDramWait || CurrentState == ReadBurstFill) && CpuStrobe_H == 0)
+			ReadCycleEnded_H <= 1;
+	end
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////-
+// Open row registers: remember which row was activated in each bank, forget them all when the banks are precharged
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////-
+
+	always@(posedge Clock, negedge Reset_L)
+	begin
+		if(Reset_L == 0)
+			OpenRowValid <= 4'b0000;
+		else if(OpenRowClearAll_H == 1)
+			OpenRowValid <= 4'b0000;
+		else if(OpenRowLoad_H == 1) begin
+			OpenRowValid[CpuBank] <= 1'b1;
+			OpenRow[CpuBank] <= CpuRow;
+		end
+		else if(OpenRowLoadDrain_H == 1) begin
+			OpenRowValid[DrainBank] <= 1'b1;
+			OpenRow[DrainBank] <= DrainRow;
+		end
+		else if(OpenRowLoadLook_H == 1) begin
+			OpenRowValid[LookBank] <= 1'b1;
+			OpenRow[LookBank] <= LookRow;
+		end
+		else if(OpenRowClearLook_H == 1)
+			OpenRowValid[LookBank] <= 1'b0;
+	end
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////-
+// Per bank timers: loaded by each activate, precharge and write sent to a bank, then count down to 0 (ready)
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////-
+
+	always@(posedge Clock, negedge Reset_L)
+	begin
+		if(Reset_L == 0)
+			for(b = 0; b < 4; b = b + 1) begin
+				BankColTimer[b] <= 4'd0;
+				BankRowTimer[b] <= 4'd0;
+			end
+		else
+			for(b = 0; b < 4; b = b + 1) begin
+				if(BankColTimer[b] != 4'd0)
+					BankColTimer[b] <= BankColTimer[b] - 4'd1;
+
+				if(BankRowTimer[b] != 4'd0)
+					BankRowTimer[b] <= BankRowTimer[b] - 4'd1;
+
+				if(Command == BankActivate && BankAddress == b) begin
+					BankColTimer[b] <= TrcdClocks - 1;
+					BankRowTimer[b] <= TrasClocks - 1;
+				end
+				else if(Command == PrechargeSelectBank && (DramAddress[10] == 1 || BankAddress == b))
+					BankRowTimer[b] <= TrpClocks - 1;
+				else if(Command == WriteOnly && BankAddress == b && BankRowTimer[b] < TwrClocks)
+					BankRowTimer[b] <= TwrClocks - 1;
+			end
+	end
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////-
+// Write queue: look for the CPU's address in the queue, and add/merge or remove entries
+// A write to an address already queued merges its bytes into that entry, so there is at most one entry per address
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////-
+
+	always@(*)
+	begin
+		WqMatch_H <= 0;
+		WqMatchIndex <= 3'd0;
+
+		for(i = 0; i < WriteQueueDepth; i = i + 1)
+			if(WqValid[i] == 1 && WqAddress[i] == Address[25:1]) begin
+				WqMatch_H <= 1;
+				WqMatchIndex <= i;
+			end
+	end
+
+	always@(posedge Clock, negedge Reset_L)
+	begin
+		if(Reset_L == 0) begin
+			WqValid <= 8'h00;
+			WqHead <= 3'd0;
+			WqTail <= 3'd0;
+		end
+		else begin
+			if(WqPush_H == 1) begin
+				if(WqMatch_H == 1) begin						// merge with the queued write to the same address
+					if(UDS_L == 0) begin
+						WqData[WqMatchIndex][15:8] <= DataIn[15:8];
+						WqUpper[WqMatchIndex] <= 1;
+					end
+					if(LDS_L == 0) begin
+						WqData[WqMatchIndex][7:0] <= DataIn[7:0];
+						WqLower[WqMatchIndex] <= 1;
+					end
+				end
+				else begin										// new entry at the tail
+					WqAddress[WqTail] <= Address[25:1];
+					WqData[WqTail] <= DataIn;
+					WqUpper[WqTail] <= ~UDS_L;
+					WqLower[WqTail] <= ~LDS_L;
+					WqValid[WqTail] <= 1;
+					WqTail <= (WqTail + 3'd1) & (WriteQueueDepth - 1);
+				end
+			end
+
+			if(WqPop_H == 1) begin
+				WqValid[WqHead] <= 0;
+				WqHead <= (WqHead + 3'd1) & (WriteQueueDepth - 1);
+			end
+		end
+	end
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////-
+// Performance counters: count events while enabled, cleared/enabled by writes from the 68000
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////-
+
+	wire CpuWantsDram_H = (DramSelect_L == 0 && AS_L == 0);
+	wire InRefresh_H = (CurrentState == AutorefreshPrecharge || CurrentState == AutorefreshNop ||
+							  CurrentState == AutorefreshState || CurrentState == AutorefreshNopCycle);
+	wire PerfRegisterWrite_H = (PerfSelect_H == 1 && AS_L == 0 && WE_L == 0 && (UDS_L == 0 || LDS_L == 0) && Address[5] == 1);
+
+	always@(posedge Clock, negedge Reset_L)
+	begin
+		if(Reset_L == 0) begin
+			PerfEnable_H <= 0;
+			PerfAccessCounted_H <= 0;
+			for(n = 0; n < 8; n = n + 1)
+				PerfCount[n] <= 32'd0;
+		end
+		else begin
+			PerfAccessCounted_H <= CpuWantsDram_H;				// count each bus cycle once, when it starts
+
+			if(PerfRegisterWrite_H == 1) begin
+				PerfEnable_H <= DataIn[1];
+				if(DataIn[0] == 1)
+					for(n = 0; n < 8; n = n + 1)
+						PerfCount[n] <= 32'd0;
+			end
+			else if(PerfEnable_H == 1) begin
+				PerfCount[PerfCycles] <= PerfCount[PerfCycles] + 32'd1;
+
+				if(CpuRead_H == 1 && PerfAccessCounted_H == 0)
+					PerfCount[PerfReads] <= PerfCount[PerfReads] + 32'd1;
+
+				if(CpuWrite_H == 1 && PerfAccessCounted_H == 0)
+					PerfCount[PerfWrites] <= PerfCount[PerfWrites] + 32'd1;
+
+				if(Command == BankActivate)
+					PerfCount[PerfActivates] <= PerfCount[PerfActivates] + 32'd1;
+
+				if(CurrentState == IdleState && (Command == ReadOnly || Command == WriteOnly))		// column command straight from idle, row was already open
+					PerfCount[PerfRowHits] <= PerfCount[PerfRowHits] + 32'd1;
+
+				if(Command == PrechargeSelectBank && DramAddress[10] == 0)								// a single bank is only precharged on a row conflict
+					PerfCount[PerfRowConflicts] <= PerfCount[PerfRowConflicts] + 32'd1;
+
+				if(CpuWantsDram_H == 1 && InRefresh_H == 1)
+					PerfCount[PerfRefreshStalls] <= PerfCount[PerfRefreshStalls] + 32'd1;
+
+				if(CpuWantsDram_H == 1 && Dtack_L == 1)
+					PerfCount[PerfDtackWaits] <= PerfCount[PerfDtackWaits] + 32'd1;
+			end
+		end
+	end
+
+	always@(*)
+	begin
+		if(Address[5] == 1)											// control/status
+			PerfDataOut <= {14'b0, PerfEnable_H, 1'b0};
+		else if(Address[1] == 0)									// counter bits 31-16
+			PerfDataOut <= PerfCount[Address[4:2]][31:16];
+		else																// counter bits 15-0
+			PerfDataOut <= PerfCount[Address[4:2]][15:0];
+	end
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////-
 // next state and output logic
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////	
@@ -225,22 +722,22 @@ module M68kDramController_Verilog (
 
 	// counter and nop_counter
 	always@(posedge Clock) begin 
-		if (CurrentState == NopRefresh) begin 
-			// NopRefresh: counter and nop counter
+		if (CurrentState == Refresh) begin
+			// Refresh: count the initial refreshes
 			counter <= counter + 1'b1;
-			nopCounter <= nopCounter + 1'b1;
+			nopCounter <= 4'b0000;
 		end
-		else if (CurrentState == ProgramModeRegisterNop || CurrentState == AutorefreshNopCycle) begin 
+		else if (CurrentState == NopRefresh) begin 
+			// NopRefresh: hold the count
+			nopCounter <= 4'b0000;
+		end
+		else if (CurrentState == ProgramModeRegisterNop) begin 
 			// ProgramModeRegisterNop: nop counter
-			// AutorefreshNopCycle: nop counter
-			counter <= 6'b000000;
+			counter <= 7'd0;
 			nopCounter <= nopCounter + 1'b1;
-		end	else if (CurrentState == Refresh) begin
-			counter <= counter + 1'b1;
-			nopCounter <= 4'b0000;
 		end else begin
 			nopCounter <= 4'b0000;
-			counter <= 6'b000000;
+			counter <= 7'd0;
 		end
 	end
 
@@ -262,23 +759,37 @@ module M68kDramController_Verilog (
 		NextState <= IdleState ;							// assume next state will always be idle state unless overridden the value used here is not important, we cimple have to assign something to prevent storage on the signal so anything will do
 		
 		TimerValue <= 16'h0000;										// no timer value 
-		RefreshTimerValue <= 16'h0000 ;							// no refresh timer value
+		RefreshTimerValue <= RefreshClocks ;						// tREFI, 375 clock cycles at 50MHz
 		TimerLoad_H <= 0;												// don't load Timer
-		RefreshTimerLoad_H <= 0 ;									// don't load refresh timer
+		RefreshTimerLoad_H <= RefreshTick_H ;						// refresh timer restarts itself each time it expires
 		DramAddress <= 13'h0000 ;									// no particular dram address
 		BankAddress <= 2'b00 ;										// no particular dram bank address
 		DramDataLatch_H <= 0;										// don't latch data yet
 		CPU_Dtack_L <= 1 ;											// don't acknowledge back to 68000
 		SDramWriteData <= 16'h0000 ;								// nothing to write in particular
+		DramDQM <= 2'b00 ;											// both bytes enabled
 		CPUReset_L <= 1 ;												// default is reset to CPU (for the moment, though this will change when design is complete so that reset-out goes high at the end of the dram initialisation phase to allow CPU to resume)
 		FPGAWritingtoSDram_H <= 0 ;								// default is to tri-state the FPGA data lines leading to bi-directional SDRam data lines, i.e. assume a read operation
+		OpenRowLoad_H <= 0 ;											// open rows unchanged
+		OpenRowClearAll_H <= 0 ;
+		OpenRowLoadDrain_H <= 0 ;
+		OpenRowLoadLook_H <= 0 ;
+		OpenRowClearLook_H <= 0 ;
+		LineFillStart_H <= 0 ;										// line buffer unchanged
+		LineCapture_H <= 0 ;
+		LineFillDone_H <= 0 ;
+		LineInvalidate_H <= 0 ;
+		LineHitLoad_H <= 0 ;
+		WqPush_H <= 0 ;												// write queue unchanged
+		WqPop_H <= 0 ;
+		WqForward_H <= 0 ;
 
 		// put your current state/next state decision making logic here - here are a few states to get you started
 		// during the initialising state, the drams have to power up and we cannot access them for a specified period of time (100 us)
 		// we are going to load the timer above with a value equiv to 100us and then wait for timer to time out
 	
 		if(CurrentState == InitialisingState ) begin
-			TimerValue <= 16'd5000;									// chose a value equivalent to 100us (5000 clock cycles) at 50Mhz clock - you might want to shorten it to somthing small for simulation purposes (8)
+			TimerValue <= PowerUpClocks;								// 100us (5000 clock cycles at 50Mhz) - you might want to override tPowerUp_ns with somthing small for simulation purposes
 			TimerLoad_H <= 1 ;										// on next edge of clock, timer will be loaded and start to time out
 			CPUReset_L <= 0 ;
 			Command <= PoweringUp ;									// clock enable and chip select to the Zentel Dram chip must be held low (disabled) during a power up phase
@@ -308,6 +819,8 @@ module M68kDramController_Verilog (
 
 			CPUReset_L <= 0 ;
 			DramAddress <= 13'b0010000000000;	// 0x400, set A10 to 1 to indicate precharge ALL banks
+			TimerValue <= TrpWait;				// time tRP
+			TimerLoad_H <= 1;
 			NextState <= PrechargeNop;	
 		end	
 
@@ -315,13 +828,19 @@ module M68kDramController_Verilog (
 			Command <= NOP;	
 
 			CPUReset_L <= 0 ;
-			NextState <= Refresh;
+			if (TimerDone_H == 1) begin
+				NextState <= Refresh;
+			end else begin
+				NextState <= PrechargeNop;
+			end
 		end
 		
 		else if (CurrentState == Refresh) begin
 			Command <= AutoRefresh;
 
 			CPUReset_L <= 0 ;
+			TimerValue <= TrfcWait; // time tRFC
+			TimerLoad_H <= 1;
 			NextState <= NopRefresh;
 		end
 
@@ -330,11 +849,11 @@ module M68kDramController_Verilog (
 
 			CPUReset_L <= 0 ;
 
-			if (nopCounter < 2) begin // haven't done 3 NOPS after refresh
+			if (TimerDone_H == 0) begin // still within tRFC of the refresh
 				NextState <= NopRefresh;
-			end else if (counter < 45) begin // did 3 NOPS, haven't done 10 refresh cycles yet
+			end else if (counter < InitialRefreshes) begin // haven't done all the refresh cycles yet
      			NextState <= Refresh;
-			end else begin // done 10 refresh cycles
+			end else begin // done all the refresh cycles
      			NextState <= ProgramModeRegister;
 			end
 		end
@@ -343,7 +862,7 @@ module M68kDramController_Verilog (
 			Command <= ModeRegisterSet;
 
 			CPUReset_L <= 0 ;
-			DramAddress <= 13'h220; // present mode data on dram address bus
+			DramAddress <= {3'b000, 1'b1, 2'b00, CASLatencyCode, 1'b0, BurstLengthCode}; // present mode data on dram address bus: single word writes, CAS latency, sequential burst of LineWords reads
 
 			NextState <= ProgramModeRegisterNop;
 		end
@@ -363,8 +882,7 @@ module M68kDramController_Verilog (
 			Command <= NOP;
 
 			CPUReset_L <= 0 ;
-			RefreshTimerValue <= 16'd375; // 7.5us: 375 clock cycles
-			RefreshTimerLoad_H <= 1'b1;	
+			RefreshTimerLoad_H <= 1'b1; // start the refresh timer
 			
 			NextState <= IdleState;
 		end
@@ -372,40 +890,192 @@ module M68kDramController_Verilog (
 		else if (CurrentState == IdleState) begin
 			Command <= NOP;
 
-			if (RefreshTimerDone_H == 1'b1) begin
+			if (CpuRead_H == 1'b1 && WqCovered_H == 1'b1 && CpuShortcut_H == 1'b1) begin // CPU is reading a write still in the queue
+				WqForward_H <= 1'b1; // data from the queue, no SDRAM command
+				CPU_Dtack_L <= 1'b0;
+				NextState <= CpuWait;
+
+			end else if (CpuRead_H == 1'b1 && WqMatch_H == 1'b0 && LineHit_H == 1'b1 && CpuShortcut_H == 1'b1) begin // CPU is reading a word in the line buffer
+				LineHitLoad_H <= 1'b1; // data from the line buffer, no SDRAM command
+				CPU_Dtack_L <= 1'b0;
+				NextState <= CpuWait;
+
+			end else if (RefreshForced_H == 1'b1) begin // too many refreshes put off, do one now
 				NextState <= AutorefreshPrecharge;
 
-			end else if (DramSelect_L == 1'b0 && AS_L == 1'b0) begin // CPU is accessing DRAM
-				DramAddress <= Address[23:11]; // issue a 13 bit row address to SDRAM from CPU
-				BankAddress <= Address[25:24]; // issue a 2 bit bank address to the SDRAM
-				Command <= BankActivate; // issue a bank activate command to the SDRAM
+			end else if (CpuWrite_H == 1'b1 && (WqFull_H == 1'b0 || WqMatch_H == 1'b1)) begin // room in the queue, wait for the data strobes
+				NextState <= WriteDram;
 
-				if (WE_L == 1'b1) begin // CPU is reading
+			end else if (CpuRead_H == 1'b1 && ReadQueueClear_H == 1'b1 && RowHit_H == 1'b1) begin // CPU is reading the row already open in this bank
+				if (BankColReady_H[CpuBank] == 1'b1) begin // tRCD has passed if the row was only just opened
+					DramAddress <= {3'b000, Address[10:1]}; // 10 bit column address, A10 = 0 so the row stays open
+					BankAddress <= CpuBank;
+					Command <= ReadOnly; // burst starts at the CPU's word and wraps within the line
+					LineFillStart_H <= 1'b1;
+					TimerLoad_H <= 1'b1; // CAS latency
+					TimerValue <= CASLatency;
+					NextState <= ReadDramWait;
+				end
+
+			end else if (CpuRead_H == 1'b1 && ReadQueueClear_H == 1'b1 && RowOpen_H == 1'b1) begin // row conflict, close the bank's open row first
+				if (BankRowReady_H[CpuBank] == 1'b1) begin // tRAS/tWR have passed
+					BankAddress <= CpuBank;
+					Command <= PrechargeSelectBank; // A10 = 0 precharges this bank only
+					TimerValue <= TrpWait; // time tRP
+					TimerLoad_H <= 1'b1;
+					NextState <= PrechargeConflictNop;
+				end
+
+			end else if (CpuRead_H == 1'b1 && ReadQueueClear_H == 1'b1) begin // CPU is reading DRAM, bank is closed
+				if (BankRowReady_H[CpuBank] == 1'b1) begin // tRP has passed
+					DramAddress <= CpuRow; // issue a 13 bit row address to SDRAM from CPU
+					BankAddress <= CpuBank; // issue a 2 bit bank address to the SDRAM
+					Command <= BankActivate; // issue a bank activate command to the SDRAM
+					OpenRowLoad_H <= 1'b1; // remember the row we've opened
+					TimerValue <= TrcdWait; // time tRCD
+					TimerLoad_H <= 1'b1;
 					NextState <= ReadDram;
+				end
 
-				end else begin // CPU is writing
-					NextState <= WriteDram;
+			end else if (WqEmpty_H == 1'b0) begin // nothing else to do, queue full, or a read needs a queued write in the SDRAM first
+				if (DrainRowHit_H == 1'b1) begin // row already open, write the oldest entry now
+					if (BankColReady_H[DrainBank] == 1'b1) begin // tRCD has passed if the row was opened ahead of time
+						DramAddress <= {3'b000, DrainAddress[10:1]};
+						BankAddress <= DrainBank;
+						Command <= WriteOnly;
+						FPGAWritingtoSDram_H <= 1'b1;
+						SDramWriteData <= WqData[WqHead];
+						DramDQM <= {~WqUpper[WqHead], ~WqLower[WqHead]}; // mask any byte the CPU did not write
+						NextState <= DrainWriteWait;
+					end
+
+				end else if (DrainRowOpen_H == 1'b1) begin // row conflict
+					if (BankRowReady_H[DrainBank] == 1'b1) begin
+						BankAddress <= DrainBank;
+						Command <= PrechargeSelectBank;
+						TimerValue <= TrpWait;
+						TimerLoad_H <= 1'b1;
+						NextState <= DrainPrechargeNop;
+					end
+
+				end else begin // bank closed
+					if (BankRowReady_H[DrainBank] == 1'b1) begin
+						DramAddress <= DrainRow;
+						BankAddress <= DrainBank;
+						Command <= BankActivate;
+						OpenRowLoadDrain_H <= 1'b1;
+						TimerValue <= TrcdWait;
+						TimerLoad_H <= 1'b1;
+						NextState <= DrainWrite;
+					end
 				end
 
+			end else if (RefreshEarly_H == 1'b1) begin // been idle a while, refresh now rather than when the CPU wants the SDRAM
+				NextState <= AutorefreshPrecharge;
+
 			end else begin
 				NextState <= IdleState;
 			end
 		end
 
-		else if (CurrentState == AutorefreshPrecharge) begin
-			Command <= PrechargeAllBanks;
+		else if (CurrentState == PrechargeConflictNop) begin // wait tRP after precharging the bank
+			Command <= NOP;
+
+			if (TimerDone_H == 1'b1) begin
+				NextState <= ActivateRow;
+			end else begin
+				NextState <= PrechargeConflictNop;
+			end
+		end
 
-			NextState <= AutorefreshNop;	
+		else if (CurrentState == ActivateRow) begin // open the row the CPU wants
+			DramAddress <= CpuRow;
+			BankAddress <= CpuBank;
+			Command <= BankActivate;
+			OpenRowLoad_H <= 1'b1;
+			TimerValue <= TrcdWait; // time tRCD
+			TimerLoad_H <= 1'b1;
+
+			NextState <= ReadDram;
+		end
+
+		else if (CurrentState == DrainPrechargeNop) begin // wait tRP after precharging the bank
+			Command <= NOP;
+
+			if (TimerDone_H == 1'b1) begin
+				NextState <= DrainActivate;
+			end else begin
+				NextState <= DrainPrechargeNop;
+			end
+		end
+
+		else if (CurrentState == DrainActivate) begin // open the row for the oldest queued write
+			DramAddress <= DrainRow;
+			BankAddress <= DrainBank;
+			Command <= BankActivate;
+			OpenRowLoadDrain_H <= 1'b1;
+			TimerValue <= TrcdWait; // time tRCD
+			TimerLoad_H <= 1'b1;
+
+			NextState <= DrainWrite;
+		end
+
+		else if (CurrentState == DrainWrite) begin
+			if (TimerDone_H == 1'b1) begin // tRCD has passed since the activate
+				DramAddress <= {3'b000, DrainAddress[10:1]}; // 10 bit column address, A10 = 0 leaves the row open
+				BankAddress <= DrainBank;
+				Command <= WriteOnly;
+				FPGAWritingtoSDram_H <= 1'b1;
+				SDramWriteData <= WqData[WqHead];
+				DramDQM <= {~WqUpper[WqHead], ~WqLower[WqHead]}; // mask any byte the CPU did not write
+
+				NextState <= DrainWriteWait;
+			end else begin
+				Command <= NOP;
+				NextState <= DrainWrite;
+			end
+		end
+
+		else if (CurrentState == DrainWriteWait) begin
+			Command <= NOP;
+			FPGAWritingtoSDram_H <= 1'b1; // keep driving the data to the sdram
+			SDramWriteData <= WqData[WqHead];
+			WqPop_H <= 1'b1; // entry is in the SDRAM now
+			if (DrainLineBase == LineBase)
+				LineInvalidate_H <= 1'b1; // line may have been filled while this write was queued
+
+			NextState <= IdleState;
+		end
+
+		else if (CurrentState == AutorefreshPrecharge) begin
+			if (BankRowReady_H == 4'b1111) begin // every bank can be precharged (rows opened ahead of time may be recent)
+				Command <= PrechargeAllBanks;
+				DramAddress <= 13'b0010000000000; // A10 = 1 to precharge ALL banks, closes any open rows
+				OpenRowClearAll_H <= 1'b1;
+				TimerValue <= TrpWait; // time tRP
+				TimerLoad_H <= 1'b1;
+
+				NextState <= AutorefreshNop;
+			end else begin
+				Command <= NOP;
+				NextState <= AutorefreshPrecharge;
+			end
 		end
 
 		else if (CurrentState == AutorefreshNop) begin
 			Command <= NOP;
 
-			NextState <= AutorefreshState;
+			if (TimerDone_H == 1'b1) begin
+				NextState <= AutorefreshState;
+			end else begin
+				NextState <= AutorefreshNop;
+			end
 		end
 
 		else if (CurrentState == AutorefreshState) begin
 			Command <= AutoRefresh;
+			TimerValue <= TrfcWait; // time tRFC
+			TimerLoad_H <= 1'b1;
 
 			NextState <= AutorefreshNopCycle;
 		end
@@ -413,74 +1083,80 @@ module M68kDramController_Verilog (
 		else if (CurrentState == AutorefreshNopCycle) begin
 			Command <= NOP;
 
-			if (nopCounter < 3) begin
-			    NextState <= AutorefreshNopCycle;
+			if (TimerDone_H == 1'b1) begin
+			    NextState <= IdleState;
 			end else begin
-			    NextState <= LoadRefreshTimer;
+			    NextState <= AutorefreshNopCycle;
 			end
 
 		end
 
-		else if (CurrentState == LoadRefreshTimer) begin
-			Command <= NOP;
-
-			RefreshTimerValue <= 16'd375; // 7.5us: 375 clock cycles
-			RefreshTimerLoad_H <= 1'b1;	
-			
-			NextState <= IdleState;
-		end
-
 		else if (CurrentState == WriteDram) begin
 			if (UDS_L == 1'b0 || LDS_L == 1'b0) begin // if UDS or LDS (or both) go low
-				DramAddress <= {3'b001, Address[10:1]}; // issue 10 bit column address
-				BankAddress <= Address[25:24]; // issue 2 bit bank address
-				Command <= WriteAutoPrecharge; // issue writeautoprecharge cmd
-				CPU_Dtack_L <= 1'b0; // issue CPU_Dtack_L
-				FPGAWritingtoSDram_H <= 1'b1; // turn on sdram bi-directional data lines
-				SDramWriteData <= DataIn; // copy CPU data out into sdram data in
-				NextState <= WriteDramWait;
+				WqPush_H <= 1'b1; // queue the write, it goes to the SDRAM later
+				CPU_Dtack_L <= 1'b0; // and let the CPU carry on now
+				if (CpuLineBase == LineBase)
+					LineInvalidate_H <= 1'b1; // buffered copy of this line is now stale
+				NextState <= CpuWait;
 
 			end else begin
 				NextState <= WriteDram;
 			end
 		end
 
-		else if (CurrentState == WriteDramWait) begin
-			CPU_Dtack_L <= 1'b0; // keep issuing Dtack
-			Command <= NOP; // NOP
-			FPGAWritingtoSDram_H <= 1'b1; // Keep driving bidirectional lines to sdram
-			SDramWriteData <= DataIn; // keep presenting data to sdram
-			NextState <= CpuWait;
-		end
-
 		else if (CurrentState == ReadDram) begin
-			DramAddress <= {3'b001, Address[10:1]}; // issue 10 bit column address
-			BankAddress <= Address[25:24]; // issue 2 bit bank address to sdram
-			Command <= ReadAutoPrecharge; // issue readautoprecharge
-			TimerLoad_H <= 1'b1; // issue timer load signal
-			TimerValue <= 16'd2; // set timer value to 2
+			if (TimerDone_H == 1'b1) begin // tRCD has passed since the activate
+				DramAddress <= {3'b000, Address[10:1]}; // issue 10 bit column address, A10 = 0 leaves the row open
+				BankAddress <= CpuBank; // issue 2 bit bank address to sdram
+				Command <= ReadOnly; // issue read, burst starts at the CPU's word and wraps within the line
+				LineFillStart_H <= 1'b1;
+				TimerLoad_H <= 1'b1; // issue timer load signal
+				TimerValue <= CASLatency; // CAS latency
 
-			//CPU_Dtack_L <= 1'b0; // ???
+				//CPU_Dtack_L <= 1'b0; // ???
 
-			NextState <= ReadDramWait;
+				NextState <= ReadDramWait;
+			end else begin
+				Command <= NOP;
+				NextState <= ReadDram;
+			end
 		end
 
 		else if (CurrentState == ReadDramWait) begin
-			CPU_Dtack_L <= 1'b0; // keep issuing dtack
+			if (ReadDtack_H == 1'b1)
+				CPU_Dtack_L <= 1'b0; // keep issuing dtack
 			Command <= NOP; // NOP
 			DramDataLatch_H <= 1'b1; // enable data latch to capture output from sdram
 
-			if (TimerDone_H == 1'b1) begin // timer expired
-				NextState <= CpuWait;
+			if (TimerDone_H == 1'b1) begin // timer expired, CPU's word is on the data lines
+				LineCapture_H <= 1'b1;
+				NextState <= ReadBurstFill;
 			end else begin
 				NextState <= ReadDramWait;
 			end
 		end
 
+		else if (CurrentState == ReadBurstFill) begin // remaining words of the burst arrive one per clock
+			Command <= NOP;
+			LineCapture_H <= 1'b1;
+
+			if (ReadDtack_H == 1'b1) // CPU may still be in its bus cycle, but not one that started after it
+				CPU_Dtack_L <= 1'b0;
+
+			if (BurstCount == LineWords - 1) begin // this is the last word
+				LineFillDone_H <= 1'b1;
+				NextState <= CpuWait;
+			end else begin
+				NextState <= ReadBurstFill;
+			end
+		end
+
 		else if (CurrentState == CpuWait) begin
 			Command <= NOP; // NOP
 
-			if (UDS_L == 1'b0 || LDS_L == 1'b0) begin // not finished bus cycle
+			if (ReadCycleEnded_H == 1'b1) begin // read ended during the burst, any strobes now belong to the next bus cycle
+				NextState <= IdleState;
+			end else if (UDS_L == 1'b0 || LDS_L == 1'b0) begin // not finished bus cycle
 				CPU_Dtack_L <= 1'b0; // keep issuing dtack
 				NextState <= CpuWait;
 			end else begin
@@ -488,6 +1164,20 @@ module M68kDramController_Verilog (
 			end
 		end
 
-		
+		// bank lookahead: while the data lines are busy, or the CPU is finishing its bus cycle, open the bank the next
+		// queued write needs (or close the wrong row in it) using the otherwise idle command slot
+
+		if (LookAhead_H == 1'b1) begin
+			BankAddress <= LookBank;
+			if (OpenRowValid[LookBank] == 1'b0) begin
+				DramAddress <= LookRow;
+				Command <= BankActivate;
+				OpenRowLoadLook_H <= 1'b1;
+			end else begin
+				DramAddress <= 13'h0000; // A10 = 0 precharges this bank only
+				Command <= PrechargeSelectBank;
+				OpenRowClearLook_H <= 1'b1;
+			end
+		end
 	end	// always@ block
 endmodule
@@ -0,0 +1,340 @@
+//////////////////////////////////////////////////////////////////////////////////////-
+// Memory BIST (built in self test) engine for the DE1 Dram controller
+//
+// Sits between the 68000 and M68kDramController_Verilog and runs a march test over
+// a range of Dram at full controller speed. It does this by driving the controller's
+// 68k style inputs (AS/UDS/LDS/WE/DramSelect) itself and starting the next access as
+// soon as the controller finishes the last one, instead of waiting for 68k bus cycles.
+//
+// March used (one 16 bit word per access)
+//		element 0: up   (w P)
+//		element 1: up   (r P,  w ~P)
+//		element 2: down (r ~P, w P)
+//		element 3: up   (r P)
+//
+// where P is the data pattern for the address selected by the control register
+//		00 = address in data, 01 = checkerboard, 10 = walking ones
+//
+// The 68000 always has priority: between BIST accesses the controller is handed back to
+// the CPU if it wants it, and the CPU's Dtack is held off while the BIST owns the controller
+//
+// Registers (16 bit, must be written as words) at hex 0040 8100 - 0040 813F
+//		8100	Control (write): bit 0 = start, bit 1 = IRQ enable, bits 3-2 = pattern, bit 4 = clear done/IRQ
+//				Status  (read) : bit 0 = busy, bit 1 = IRQ enable, bits 3-2 = pattern, bit 7 = done, bit 8 = failed
+//		8102	Start address bits 31-16			8104	Start address bits 15-0
+//		8106	End address bits 31-16 (inclusive)	8108	End address bits 15-0
+//		810A	Fail count (saturates at FFFF)
+//		8110 + 8*n	Fail n address bits 31-16, address bits 15-0, syndrome (expected xor read), expected data
+//
+// In MC68K.bdf AS_L, UDS_L, LDS_L, WE_L, Address, DataIn and DramSelect_L from the 68000/address
+// decoder go into the Cpu inputs of this block and its Dram outputs drive the Dram controller.
+// Dtack from the controller comes in on DtackFromDram_L and DtackToCpu_L goes to the Dtack generator
+// in its place. Ready_H/AccessDone_H from the controller go to DramReady_H/DramAccessDone_H, and
+// DramBistAccess_H goes to the controller's BistAccess_H so BIST reads always come from the SDRAM.
+// BistSelect_H comes from the address decoder, DataOut goes onto the 68k data in bus when
+// BistSelect_H is active. BistIrq_L drives IRQ6_L of the interrupt priority encoder (autovector 30)
+//////////////////////////////////////////////////////////////////////////////////////-
+
+module M68kMemoryBist_Verilog (
+			input Clock,								// same clock as the Dram controller
+			input Reset_L,     						// active low reset
+
+			// from the 68000
+			input unsigned [31:0] CpuAddress,		// address bus from 68000
+			input unsigned [15:0] CpuDataIn,		// data bus from 68000
+			input CpuUDS_L,
+			input CpuLDS_L,
+			input CpuWE_L,
+			input CpuAS_L,
+			input CpuDramSelect_L,					// active low Dram select from the address decoder
+			input BistSelect_H,						// active high when the 68000 is accessing the BIST registers
+
+			output reg unsigned [15:0] DataOut,	// BIST register data back to the 68000
+			output reg DtackToCpu_L,				// Dram controller Dtack, held off while the BIST owns the controller
+			output BistIrq_L,							// test finished and IRQ enabled, active low
+
+			// to/from the Dram controller
+			output reg unsigned [31:0] DramAddress,
+			output reg unsigned [15:0] DramDataIn,
+			output reg DramUDS_L,
+			output reg DramLDS_L,
+			output reg DramWE_L,
+			output reg DramAS_L,
+			output reg DramSelect_L,
+			output DramBistAccess_H,					// access is the BIST's, not the 68000's
+
+			input unsigned [15:0] DramDataOut,		// read data from the Dram controller
+			input DtackFromDram_L,						// Dtack from the Dram controller
+			input DramReady_H,							// Ready_H from the Dram controller, idle and able to start an access
+			input DramAccessDone_H,					// AccessDone_H from the Dram controller, read data latched or write taken
+
+			output unsigned [2:0] BistState			// for debugging
+		);
+
+		parameter NumFailEntries = 4;						// number of failing addresses captured
+
+		// BIST states
+
+		parameter BistIdle = 3'h0;
+		parameter BistArbitrate = 3'h1;					// wait for the controller to be idle and the CPU not to want it
+		parameter BistAccess = 3'h2;						// one read or write to the controller
+		parameter BistRelease = 3'h3;						// end the access and wait for the controller to go idle
+		parameter BistNext = 3'h4;							// move on to the next access
+
+		reg unsigned [2:0] CurrentState;
+		reg unsigned [2:0] NextState;
+
+		// registers programmed by the 68000
+		reg unsigned [31:0] StartAddress;
+		reg unsigned [31:0] EndAddress;
+		reg unsigned [1:0] Pattern;
+		reg IrqEnable_H;
+		reg StartPending_H;								// start written, test not begun yet
+		reg Done_H;
+
+		// results
+		reg unsigned [15:0] FailCount;
+		reg unsigned [31:0] FailAddress [0:NumFailEntries-1];
+		reg unsigned [15:0] FailSyndrome [0:NumFailEntries-1];
+		reg unsigned [15:0] FailExpected [0:NumFailEntries-1];
+
+		// test sequencing
+		reg unsigned [31:0] BistAddress;					// address being tested
+		reg unsigned [1:0] Element;						// march element 0-3
+		reg WritePhase_H;										// doing the write half of a read/write element
+		reg BistOwns_H;										// BIST has the Dram controller, the CPU does not
+
+		wire unsigned [15:0] P;
+		wire IsWrite_H, LastAddress_H, CpuWantsDram_H, RegisterWrite_H;
+		wire unsigned [15:0] ExpectedData, WriteData;
+
+		integer i;
+
+		assign BistState = CurrentState;
+		assign BistIrq_L = ~(Done_H & IrqEnable_H);
+		assign DramBistAccess_H = BistOwns_H;
+
+		// data pattern for an address, elements 1 and 2 use the complement as the "1" value of the march
+
+		assign P = (Pattern == 2'b00) ? (BistAddress[16:1] ^ {7'b0, BistAddress[25:17]}) :
+					  (Pattern == 2'b01) ? ((BistAddress[1] ^ BistAddress[11]) ? 16'hAAAA : 16'h5555) :	// alternates along a row and from row to row
+					  (16'h0001 << BistAddress[4:1]) ;
+
+		assign ExpectedData = (Element == 2'd2) ? ~P : P;
+		assign WriteData = (Element == 2'd1) ? ~P : P;
+
+		assign IsWrite_H = (Element == 2'd0) | WritePhase_H;
+		assign LastAddress_H = (Element == 2'd2) ? (BistAddress[31:1] == StartAddress[31:1]) : (BistAddress[31:1] == EndAddress[31:1]);
+
+		assign CpuWantsDram_H = (CpuAS_L == 0) & (CpuDramSelect_L == 0);
+		assign RegisterWrite_H = BistSelect_H & (CpuAS_L == 0) & (CpuWE_L == 0) & ((CpuUDS_L == 0) | (CpuLDS_L == 0));
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// Register read back to the 68000
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+	always@(*) begin
+		DataOut <= 16'h0000;
+
+		if(CpuAddress[5:1] == 5'd0)
+			DataOut <= {7'b0, (FailCount != 0), Done_H, 3'b000, Pattern, IrqEnable_H, (CurrentState != BistIdle) | StartPending_H};
+		else if(CpuAddress[5:1] == 5'd1)
+			DataOut <= StartAddress[31:16];
+		else if(CpuAddress[5:1] == 5'd2)
+			DataOut <= StartAddress[15:0];
+		else if(CpuAddress[5:1] == 5'd3)
+			DataOut <= EndAddress[31:16];
+		else if(CpuAddress[5:1] == 5'd4)
+			DataOut <= EndAddress[15:0];
+		else if(CpuAddress[5:1] == 5'd5)
+			DataOut <= FailCount;
+		else if(CpuAddress[5:1] >= 5'd8 && CpuAddress[5:1] < 5'd8 + 4 * NumFailEntries) begin
+			if(CpuAddress[2:1] == 2'd0)
+				DataOut <= FailAddress[CpuAddress[5:3] - 3'd2][31:16];
+			else if(CpuAddress[2:1] == 2'd1)
+				DataOut <= FailAddress[CpuAddress[5:3] - 3'd2][15:0];
+			else if(CpuAddress[2:1] == 2'd2)
+				DataOut <= FailSyndrome[CpuAddress[5:3] - 3'd2];
+			else
+				DataOut <= FailExpected[CpuAddress[5:3] - 3'd2];
+		end
+	end
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// state register, 68000 register writes and test sequencing
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+	always@(posedge Clock, negedge Reset_L)
+	begin
+		if(Reset_L == 0) begin
+			CurrentState <= BistIdle;
+			StartAddress <= 0;
+			EndAddress <= 0;
+			Pattern <= 0;
+			IrqEnable_H <= 0;
+			StartPending_H <= 0;
+			Done_H <= 0;
+			FailCount <= 0;
+			BistAddress <= 0;
+			Element <= 0;
+			WritePhase_H <= 0;
+			BistOwns_H <= 0;
+		end
+		else begin
+			CurrentState <= NextState;
+
+			// registers can only be changed while the test is idle, except to clear done/IRQ
+
+			if(RegisterWrite_H == 1) begin
+				if(CpuAddress[5:1] == 5'd0) begin
+					if(CpuDataIn[4] == 1)
+						Done_H <= 0;
+
+					if(CurrentState == BistIdle && StartPending_H == 0) begin
+						IrqEnable_H <= CpuDataIn[1];
+						Pattern <= CpuDataIn[3:2];
+						StartPending_H <= CpuDataIn[0];
+					end
+				end
+				else if(CurrentState == BistIdle && StartPending_H == 0) begin
+					if(CpuAddress[5:1] == 5'd1)			StartAddress[31:16] <= CpuDataIn;
+					else if(CpuAddress[5:1] == 5'd2)		StartAddress[15:0] <= CpuDataIn;
+					else if(CpuAddress[5:1] == 5'd3)		EndAddress[31:16] <= CpuDataIn;
+					else if(CpuAddress[5:1] == 5'd4)		EndAddress[15:0] <= CpuDataIn;
+				end
+			end
+
+			// start of a test
+
+			if(CurrentState == BistIdle && StartPending_H == 1) begin
+				StartPending_H <= 0;
+				Done_H <= 0;
+				FailCount <= 0;
+				BistAddress <= {StartAddress[31:1], 1'b0};
+				Element <= 0;
+				WritePhase_H <= 0;
+			end
+
+			// take the controller once it's idle and the CPU is not using it
+
+			if(CurrentState == BistArbitrate && NextState == BistAccess)
+				BistOwns_H <= 1;
+
+			// check the read data once the controller has latched it
+
+			if(CurrentState == BistAccess && DramAccessDone_H == 1 && IsWrite_H == 0 && DramDataOut != ExpectedData) begin
+				if(FailCount < NumFailEntries) begin
+					FailAddress[FailCount] <= BistAddress;
+					FailSyndrome[FailCount] <= DramDataOut ^ ExpectedData;
+					FailExpected[FailCount] <= ExpectedData;
+				end
+
+				if(FailCount != 16'hFFFF)
+					FailCount <= FailCount + 16'd1;
+			end
+
+			// hand the controller back to the CPU as soon as it has gone idle
+
+			if(CurrentState == BistRelease && DramReady_H == 1)
+				BistOwns_H <= 0;
+
+			// move on to the write half of a read/write element, or the next address, or the next element
+
+			if(CurrentState == BistNext) begin
+				if((Element == 2'd1 || Element == 2'd2) && WritePhase_H == 0)
+					WritePhase_H <= 1;
+				else begin
+					WritePhase_H <= 0;
+
+					if(LastAddress_H == 1) begin
+						if(Element == 2'd3)
+							Done_H <= 1;
+						else begin
+							Element <= Element + 2'd1;
+							if(Element == 2'd1)
+								BistAddress <= {EndAddress[31:1], 1'b0};		// element 2 runs down
+							else
+								BistAddress <= {StartAddress[31:1], 1'b0};
+						end
+					end
+					else if(Element == 2'd2)
+						BistAddress <= BistAddress - 32'd2;
+					else
+						BistAddress <= BistAddress + 32'd2;
+				end
+			end
+		end
+	end
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// next state and Dram controller bus logic
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+	always@(*) begin
+
+		// default is to give the Dram controller the 68k's signals directly
+
+		DramAddress <= CpuAddress;
+		DramDataIn <= CpuDataIn;
+		DramUDS_L <= CpuUDS_L;
+		DramLDS_L <= CpuLDS_L;
+		DramWE_L <= CpuWE_L;
+		DramAS_L <= CpuAS_L;
+		DramSelect_L <= CpuDramSelect_L;
+		DtackToCpu_L <= DtackFromDram_L;
+
+		NextState <= BistIdle;
+
+		// while the BIST owns the controller, the CPU sees no Dram activity and waits for its Dtack
+
+		if(BistOwns_H == 1) begin
+			DramAddress <= BistAddress;
+			DramDataIn <= WriteData;
+			DramUDS_L <= 1;
+			DramLDS_L <= 1;
+			DramWE_L <= 1;
+			DramAS_L <= 1;
+			DramSelect_L <= 1;
+			DtackToCpu_L <= 1;
+		end
+
+		if(CurrentState == BistIdle) begin
+			if(StartPending_H == 1)
+				NextState <= BistArbitrate;
+		end
+
+		else if(CurrentState == BistArbitrate) begin
+			if(CpuWantsDram_H == 0 && DramReady_H == 1 && DtackFromDram_L == 1)
+				NextState <= BistAccess;
+			else
+				NextState <= BistArbitrate;
+		end
+
+		else if(CurrentState == BistAccess) begin
+			DramUDS_L <= 0;
+			DramLDS_L <= 0;
+			DramWE_L <= ~IsWrite_H;
+			DramAS_L <= 0;
+			DramSelect_L <= 0;
+
+			if(DramAccessDone_H == 1)					// read data latched or write done
+				NextState <= BistRelease;
+			else
+				NextState <= BistAccess;
+		end
+
+		else if(CurrentState == BistRelease) begin	// strobes off, wait for the controller to leave CpuWait and go idle
+			if(DramReady_H == 1)
+				NextState <= BistNext;
+			else
+				NextState <= BistRelease;
+		end
+
+		else if(CurrentState == BistNext) begin
+			if(Element == 2'd3 && LastAddress_H == 1)
+				NextState <= BistIdle;
+			else
+				NextState <= BistArbitrate;
+		end
+	end
+endmodule
@@ -1,53 +1,357 @@
+`timescale 1ns / 1ps
+//////////////////////////////////////////////////////////////////////////////////////-
+// Self checking testbench for M68kDramController_Verilog
+//
+// The controller drives sdram_model.v, a behavioural SDRAM which checks every command
+// against the SDRAM timing (tRCD, tRP, tRC, tRAS, tWR, tRFC, CAS latency, refresh interval).
+// A 68000 bus functional model (CpuRead/CpuWrite tasks) runs these phases of traffic:
+//		1. streaming writes through a window in each of the 4 banks
+//		2. streaming reads of the same addresses
+//		3. random reads/writes (words and single bytes), half of them near the last address so there
+//		   are row and line hits
+//		4. back to back streaming reads, the next bus cycle starting the clock after the strobes go away
+//		5. back to back read, write, read of neighbouring words, same as 4
+//		6. idle, so refreshes are done early
+//		7. read back of every address written
+// Every read is compared with a scoreboard of the data last written to that address.
+// At the end the average Dtack latency and throughput of each phase are printed.
+// The bench is run twice at the same time, with a 4 word and an 8 word line (LineWords), and
+// PASSED is printed only when both pass
+//
+// Run with Icarus Verilog from this directory:
+//		iverilog -g2012 -o dram_tb dram_controller_testbench.v sdram_model.v M68kDramController_Verilog.v
+//		vvp dram_tb
+//////////////////////////////////////////////////////////////////////////////////////-
+
 module dram_controller_testbench();
+    wire Done4_H, Passed4_H, Done8_H, Passed8_H;
+
+    dram_controller_bench #(.LineWords(4)) line4 (.Done_H(Done4_H), .Passed_H(Passed4_H));
+    dram_controller_bench #(.LineWords(8)) line8 (.Done_H(Done8_H), .Passed_H(Passed8_H));
+
+    initial begin
+        wait (Done4_H == 1'b1 && Done8_H == 1'b1);
+        if (Passed4_H == 1'b1 && Passed8_H == 1'b1)
+            $display("PASSED");
+        else
+            $display("FAILED");
+        $finish;
+    end
+
+endmodule
+
+//////////////////////////////////////////////////////////////////////////////////////-
+// one controller, SDRAM model and bus functional model, LineWords is passed on to the controller
+//////////////////////////////////////////////////////////////////////////////////////-
+
+module dram_controller_bench(output reg Done_H, output reg Passed_H);
+    parameter LineWords = 4;
+    parameter ClockFrequencyMHz = 50;
+    parameter PowerUp_ns = 1000;                // shortened power up delay so the simulation gets going quickly
+    parameter StreamWords = 1024;               // words streamed through each bank
+    parameter RandomAccesses = 20000;
+    parameter WindowBits = 16;                  // each bank's window is 2^WindowBits words (Address[16:1])
+
+    localparam real HalfPeriod = 500.0 / ClockFrequencyMHz;
+
     reg Clock, Reset_L, UDS_L, LDS_L, WE_L, AS_L, DramSelect_L;
     reg [31:0] Address;
     reg [15:0] DataIn;
-     
+
     wire Dtack_L, ResetOut_L;
     wire SDram_CKE_H, SDram_CS_L, SDram_RAS_L, SDram_CAS_L, SDram_WE_L;
     wire [15:0] DataOut;
     wire [12:0] SDram_Addr;
     wire [1:0] SDram_BA;
+    wire [1:0] SDram_DQM;
     wire [15:0] SDram_DQ;
     wire [4:0] DramState;
+    wire [15:0] PerfDataOut;
+
+    M68kDramController_Verilog #(
+            .ClockFrequencyMHz(ClockFrequencyMHz),
+            .tPowerUp_ns(PowerUp_ns),
+            .LineWords(LineWords)
+    ) dut (
+            .Clock(Clock), .Reset_L(Reset_L), .Address(Address), .DataIn(DataIn),
+            .UDS_L(UDS_L), .LDS_L(LDS_L), .DramSelect_L(DramSelect_L), .WE_L(WE_L), .AS_L(AS_L),
+            .DataOut(DataOut), .SDram_CKE_H(SDram_CKE_H), .SDram_CS_L(SDram_CS_L),
+            .SDram_RAS_L(SDram_RAS_L), .SDram_CAS_L(SDram_CAS_L), .SDram_WE_L(SDram_WE_L),
+            .SDram_Addr(SDram_Addr), .SDram_BA(SDram_BA), .SDram_DQ(SDram_DQ),
+            .Dtack_L(Dtack_L), .ResetOut_L(ResetOut_L), .DramState(DramState),
+            .PerfSelect_H(1'b0), .BistAccess_H(1'b0), .PerfDataOut(PerfDataOut), .SDram_DQM(SDram_DQM)
+    );
 
-    M68kDramController_Verilog dut(
-            Clock, Reset_L, Address, DataIn, UDS_L, LDS_L,
-			DramSelect_L, WE_L, AS_L, DataOut, SDram_CKE_H,
-			SDram_CS_L, SDram_RAS_L, SDram_CAS_L, SDram_WE_L,
-			SDram_Addr,	SDram_BA, SDram_DQ, Dtack_L, ResetOut_L,
-	        DramState
-	); 	
+    sdram_model #(
+            .tPowerUp_ns(PowerUp_ns)
+    ) sdram (
+            .Clock(Clock), .CKE_H(SDram_CKE_H), .CS_L(SDram_CS_L), .RAS_L(SDram_RAS_L),
+            .CAS_L(SDram_CAS_L), .WE_L(SDram_WE_L), .Addr(SDram_Addr), .BA(SDram_BA), .DQ(SDram_DQ),
+            .DQM(SDram_DQM)
+    );
 
-    reg [2:0] refreshtimerloadcount;
+    // scoreboard: last data written to each word of the 4 windows
 
-    // clock 
+    reg [15:0] Shadow [0:(4 << WindowBits) - 1];
+    reg ShadowValid [0:(4 << WindowBits) - 1];
+
+    integer DataErrors, Timeouts, Checked, Unchecked;
+    integer ReadCount, WriteCount, ReadCycles, WriteCycles;
+    integer i, Bank, Word, LastWord, Size;
+    reg [15:0] ReadData;
+    reg [31:0] A;
+    time PhaseStart;
+
+    function integer ShadowIndex;
+        input [31:0] Addr;
+        ShadowIndex = (Addr[25:24] << WindowBits) | ((Addr >> 1) & ((1 << WindowBits) - 1));
+    endfunction
+
+    function [31:0] WindowAddress;
+        input integer Bank;
+        input integer Word;
+        WindowAddress = 32'h08000000 | (Bank << 24) | ((Word & ((1 << WindowBits) - 1)) << 1);
+    endfunction
+
+    // clock
     initial begin
         Clock = 0;
         forever begin
-            #5;
+            #(HalfPeriod);
             Clock = ~Clock;
         end
     end
 
+    //////////////////////////////////////////////////////////////////////////////////////-
+    // 68000 bus functional model, one step per controller clock
+    // AS_L and the address go out first, then the data strobes (with the data for a write)
+    // a clock later. Dtack_L is sampled on each rising edge. The 68000 latches read data one of
+    // its clocks (two controller clocks) after it sees Dtack, then negates the strobes and waits
+    // for Dtack to go away and Gap more clocks before the next bus cycle. With a Gap of 0 it does
+    // not wait for Dtack, the strobes are high for one clock only and the next cycle starts
+    //////////////////////////////////////////////////////////////////////////////////////-
+
+    task BusEnd;
+        input integer Gap;
+        integer n;
+        begin
+            AS_L <= 1;
+            UDS_L <= 1;
+            LDS_L <= 1;
+            WE_L <= 1;
+            DramSelect_L <= 1;
+            if (Gap != 0) begin
+                @(posedge Clock);
+                while (Dtack_L == 1'b0)
+                    @(posedge Clock);
+                for (n = 0; n < Gap; n = n + 1)
+                    @(posedge Clock);
+            end
+        end
+    endtask
+
+    task WaitDtack;
+        output integer Cycles;
+        begin
+            Cycles = 1;
+            @(posedge Clock);
+            while (Dtack_L !== 1'b0 && Cycles < 1000) begin
+                @(posedge Clock);
+                Cycles = Cycles + 1;
+            end
+            if (Dtack_L !== 1'b0) begin
+                $display("TESTBENCH ERROR LineWords=%0d @%0t: no Dtack for access to %h", LineWords, $time, Address);
+                Timeouts = Timeouts + 1;
+            end
+        end
+    endtask
+
+    // Upper/Lower select the bytes written, like UDS/LDS. The 68000 puts a byte on both halves of the data bus
+
+    task CpuWrite;
+        input [31:0] Addr;
+        input [15:0] Data;
+        input Upper;
+        input Lower;
+        input integer Gap;
+        integer Cycles;
+        begin
+            @(posedge Clock);
+            Address <= Addr;
+            WE_L <= 0;
+            AS_L <= 0;
+            DramSelect_L <= 0;
+            @(posedge Clock);
+            DataIn <= (Upper && Lower) ? Data : Upper ? {Data[15:8], Data[15:8]} : {Data[7:0], Data[7:0]};
+            UDS_L <= ~Upper;
+            LDS_L <= ~Lower;
+            WaitDtack(Cycles);
+            WriteCycles = WriteCycles + Cycles + 1;
+            WriteCount = WriteCount + 1;
+            @(posedge Clock);
+            BusEnd(Gap);
+
+            // a byte write to a word never written leaves the other byte unknown, so only whole words are checked
+            if (Upper && Lower) begin
+                Shadow[ShadowIndex(Addr)] = Data;
+                ShadowValid[ShadowIndex(Addr)] = 1;
+            end
+            else if (Upper)
+                Shadow[ShadowIndex(Addr)][15:8] = Data[15:8];
+            else
+                Shadow[ShadowIndex(Addr)][7:0] = Data[7:0];
+        end
+    endtask
+
+    task CpuRead;
+        input [31:0] Addr;
+        input integer Gap;
+        integer Cycles;
+        begin
+            @(posedge Clock);
+            Address <= Addr;
+            WE_L <= 1;
+            AS_L <= 0;
+            UDS_L <= 0;
+            LDS_L <= 0;
+            DramSelect_L <= 0;
+            WaitDtack(Cycles);
+            ReadCycles = ReadCycles + Cycles;
+            ReadCount = ReadCount + 1;
+            @(posedge Clock);
+            @(posedge Clock);
+            ReadData = DataOut;
+            BusEnd(Gap);
+
+            if (ShadowValid[ShadowIndex(Addr)] == 1) begin
+                Checked = Checked + 1;
+                if (ReadData !== Shadow[ShadowIndex(Addr)]) begin
+                    $display("TESTBENCH ERROR LineWords=%0d @%0t: read %h from %h, expected %h", LineWords, $time, ReadData, Addr, Shadow[ShadowIndex(Addr)]);
+                    DataErrors = DataErrors + 1;
+                end
+            end
+            else
+                Unchecked = Unchecked + 1;
+        end
+    endtask
+
+    // average latency and throughput since PhaseStart, 2 bytes per access
+
+    task PhaseReport;
+        input [8*24-1:0] Name;
+        real Elapsed;
+        begin
+            Elapsed = $time - PhaseStart;
+            $display("LineWords=%0d %0s: %0d reads avg %0.2f clocks to Dtack, %0d writes avg %0.2f clocks, %0.2f MBytes/s",
+                     LineWords, Name,
+                     ReadCount, (ReadCount != 0) ? (1.0 * ReadCycles / ReadCount) : 0.0,
+                     WriteCount, (WriteCount != 0) ? (1.0 * WriteCycles / WriteCount) : 0.0,
+                     (ReadCount + WriteCount) * 2.0 * 1000.0 / Elapsed);
+            ReadCount = 0;
+            WriteCount = 0;
+            ReadCycles = 0;
+            WriteCycles = 0;
+            PhaseStart = $time;
+        end
+    endtask
+
     initial begin
-        // reset
+        Done_H = 0;
+        Passed_H = 0;
+        AS_L = 1;
+        UDS_L = 1;
+        LDS_L = 1;
+        WE_L = 1;
+        DramSelect_L = 1;
+        Address = 0;
+        DataIn = 0;
+        DataErrors = 0;
+        Timeouts = 0;
+        Checked = 0;
+        Unchecked = 0;
+        ReadCount = 0;
+        WriteCount = 0;
+        ReadCycles = 0;
+        WriteCycles = 0;
+        for (i = 0; i < (4 << WindowBits); i = i + 1)
+            ShadowValid[i] = 0;
+
+        // reset, then wait for the controller to initialise the SDRAM
         Reset_L = 0;
-        #10;
+        #(4 * HalfPeriod);
         Reset_L = 1;
-        
-        // sit back and watch?
-        refreshtimerloadcount = 0;
-        while (refreshtimerloadcount < 3'd2) begin
-            #10;
-            if (DramState == 5'h0F) begin // LoadRefreshTimer
-                refreshtimerloadcount = refreshtimerloadcount + 1;
+        @(posedge Clock);
+        while (ResetOut_L !== 1'b1)
+            @(posedge Clock);
+        $display("LineWords=%0d controller initialised @%0t", LineWords, $time);
+
+        // 1. streaming writes
+        PhaseStart = $time;
+        for (Bank = 0; Bank < 4; Bank = Bank + 1)
+            for (Word = 0; Word < StreamWords; Word = Word + 1)
+                CpuWrite(WindowAddress(Bank, Word), $random, 1, 1, 1);
+        PhaseReport("Streaming writes");
+
+        // 2. streaming reads
+        for (Bank = 0; Bank < 4; Bank = Bank + 1)
+            for (Word = 0; Word < StreamWords; Word = Word + 1)
+                CpuRead(WindowAddress(Bank, Word), 1);
+        PhaseReport("Streaming reads");
+
+        // 3. random traffic
+        LastWord = 0;
+        Bank = 0;
+        for (i = 0; i < RandomAccesses; i = i + 1) begin
+            if ($random & 1) begin
+                Bank = $random & 3;
+                Word = $random;
             end
+            else
+                Word = LastWord + ($random % 8);        // near the last access
+            LastWord = Word;
+            A = WindowAddress(Bank, Word);
+
+            Size = $random & 3;                         // 0, 1 word, 2 upper byte, 3 lower byte
+            if ($random & 1)
+                CpuWrite(A, $random, Size != 3, Size != 2, 1 + ($random & 3));
+            else
+                CpuRead(A, 1 + ($random & 3));
+        end
+        PhaseReport("Random traffic");
+
+        // 4. back to back reads, crossing from line to line
+        for (Bank = 0; Bank < 4; Bank = Bank + 1)
+            for (Word = 0; Word < StreamWords; Word = Word + 1)
+                CpuRead(WindowAddress(Bank, Word), 0);
+        PhaseReport("Back to back reads");
+
+        // 5. back to back read/write/read, the write lands in the line just read
+        for (i = 0; i < RandomAccesses / 4; i = i + 1) begin
+            Bank = $random & 3;
+            A = WindowAddress(Bank, $random & (StreamWords - 1));
+            CpuRead(A, 0);
+            CpuWrite(A + 2, $random, 1, 1, 0);
+            CpuRead(A + 2, 0);
         end
+        PhaseReport("Back to back read/write");
+
+        // 6. idle long enough for the refresh credit counter to get ahead
+        repeat (20000 / (1000 / ClockFrequencyMHz))
+            @(posedge Clock);
 
-        $display("Simulation should be over!");
-        #5;
-        $stop;
+        // 7. read back everything written
+        PhaseStart = $time;
+        for (i = 0; i < (4 << WindowBits); i = i + 1)
+            if (ShadowValid[i] == 1)
+                CpuRead(WindowAddress(i >> WindowBits, i), 1);
+        PhaseReport("Read back");
+
+        sdram.Report;
+        $display("LineWords=%0d %0d reads checked, %0d reads of unwritten addresses, %0d data errors, %0d Dtack timeouts",
+                 LineWords, Checked, Unchecked, DataErrors, Timeouts);
+
+        Passed_H = (DataErrors == 0 && Timeouts == 0 && sdram.Errors == 0);
+        Done_H = 1;
     end
-    
-endmodule
\ No newline at end of file
+
+endmodule
@@ -0,0 +1,404 @@
+`timescale 1ns / 1ps
+//////////////////////////////////////////////////////////////////////////////////////-
+// Behavioural model of the 32Meg x16 SDRAM on the DE1 board, for simulation only
+// 8192 rows (13 bit row address), 1024 columns (10 bit column address), 4 banks
+//
+// Models the commands used by the Dram controllers: mode register set, activate,
+// read/write with or without auto precharge, precharge bank/all, auto refresh and
+// burst stop. Reads use the CAS latency and burst length (1, 2, 4, 8 or full page,
+// sequential) from the mode register, writes are single location (A9 = 1 in the mode register)
+// with the DQM byte masks applied
+//
+// Only ModelRows different rows (in any bank) can hold data, enough for a testbench
+// that keeps to a few windows of memory. Every command is checked against the timing
+// below and any violation is printed and counted in Errors:
+//		power up delay, tRCD, tRP, tRC, tRAS, tWR, tRFC, tMRD, CAS latency against the
+//		clock period, refresh interval (at most MaxPostponedRefreshes late), commands to
+//		idle/active banks, refresh/mode register set with a bank open, DQ bus contention
+//////////////////////////////////////////////////////////////////////////////////////-
+
+module sdram_model (
+			input Clock,
+			input CKE_H,								// active high clock enable
+			input CS_L,									// active low chip select
+			input RAS_L,
+			input CAS_L,
+			input WE_L,
+			input [12:0] Addr,						// row/column address
+			input [1:0] BA,							// bank address
+			inout [15:0] DQ,							// bi-directional data lines
+			input [1:0] DQM							// write byte masks, bit 1 = DQ15-8, high masks the byte
+		);
+
+		// timing in ns
+		parameter tPowerUp_ns = 100000;						// CKE low/NOP time before the first command
+		parameter tRCD_ns = 18;									// activate to read/write
+		parameter tRP_ns = 18;									// precharge to activate/refresh
+		parameter tRC_ns = 60;									// activate to activate, same bank
+		parameter tRAS_ns = 42;									// activate to precharge
+		parameter tWR_ns = 15;									// last write data to precharge
+		parameter tRFC_ns = 60;									// refresh to next command
+		parameter tREFI_ns = 7812;								// average refresh interval, 64ms / 8192 rows
+		parameter MaxPostponedRefreshes = 8;				// refreshes that may be put off
+		parameter tCK_CL2_ns = 10;								// shortest clock period for CAS latency 2
+		parameter tCK_CL3_ns = 7;								// shortest clock period for CAS latency 3
+		parameter MinInitialRefreshes = 2;					// refreshes needed before the mode register is set
+
+		parameter ModelRows = 256;								// rows that can hold data
+
+		// commands {RAS_L, CAS_L, WE_L} with CS_L low
+
+		parameter CmdModeRegisterSet = 3'b000;
+		parameter CmdRefresh = 3'b001;
+		parameter CmdPrecharge = 3'b010;
+		parameter CmdActivate = 3'b011;
+		parameter CmdWrite = 3'b100;
+		parameter CmdRead = 3'b101;
+		parameter CmdBurstStop = 3'b110;
+		parameter CmdNop = 3'b111;
+
+		reg [15:0] Mem [0:ModelRows*1024-1];				// data, 1024 words per modelled row
+		reg [14:0] RowTag [0:ModelRows-1];					// {bank, row} held in each modelled row
+		integer RowsUsed;
+
+		// mode register
+		reg ModeSet_H;
+		integer CL;												// CAS latency
+		integer BL;												// read burst length
+		reg SingleWrite_H;										// write burst mode: single location
+
+		// bank state
+		reg [3:0] BankActive;
+		integer ActiveSlot [0:3];								// modelled row for the open row in each bank
+		time LastActivate [0:3];
+		time LastPrecharge [0:3];								// when the bank started precharging
+		time LastWrite [0:3];
+
+		time Now, LastEdge, ClockPeriod;
+		time LastRefresh, LastModeRegisterSet;
+		reg PoweredUp_H, RefreshSeen_H, RefreshLate_H;
+
+		// read burst being output
+		reg ReadActive_H;
+		integer ReadDelay;										// clocks until the next word goes on DQ
+		integer ReadIndex;										// words of the burst output so far
+		integer ReadLimit;										// words to output, cut short by burst stop
+		integer ReadSlot;
+		reg [9:0] ReadCol;
+
+		reg [15:0] DQOut;
+		reg DQOutEnable_H;
+
+		// results
+		integer Errors;
+		integer Activates, Reads, Writes, Refreshes, InitialRefreshes;
+
+		reg [2:0] Cmd;
+		integer b, Slot, k;
+
+		assign DQ = DQOutEnable_H ? DQOut : 16'hzzzz;
+
+		initial begin
+			RowsUsed = 0;
+			ModeSet_H = 0;
+			CL = 2;
+			BL = 1;
+			SingleWrite_H = 1;
+			BankActive = 4'b0000;
+			for(b = 0; b < 4; b = b + 1) begin
+				ActiveSlot[b] = 0;
+				LastActivate[b] = 0;
+				LastPrecharge[b] = 0;
+				LastWrite[b] = 0;
+			end
+			LastEdge = 0;
+			ClockPeriod = 0;
+			LastRefresh = 0;
+			LastModeRegisterSet = 0;
+			PoweredUp_H = 0;
+			RefreshSeen_H = 0;
+			RefreshLate_H = 0;
+			ReadActive_H = 0;
+			DQOutEnable_H = 0;
+			DQOut = 16'h0000;
+			Errors = 0;
+			Activates = 0;
+			Reads = 0;
+			Writes = 0;
+			Refreshes = 0;
+			InitialRefreshes = 0;
+		end
+
+		// find (or allocate) the modelled row holding a bank/row
+
+		task FindRow;
+			input [1:0] Bank;
+			input [12:0] Row;
+			output integer Found;
+			integer n;
+			begin
+				Found = -1;
+				for(n = 0; n < RowsUsed; n = n + 1)
+					if(RowTag[n] == {Bank, Row})
+						Found = n;
+
+				if(Found == -1) begin
+					if(RowsUsed == ModelRows) begin
+						$display("SDRAM ERROR @%0t: more than %0d rows used, increase ModelRows", $time, ModelRows);
+						Errors = Errors + 1;
+						Found = 0;
+					end
+					else begin
+						RowTag[RowsUsed] = {Bank, Row};
+						Found = RowsUsed;
+						RowsUsed = RowsUsed + 1;
+					end
+				end
+			end
+		endtask
+
+		// close a bank with an explicit precharge, checking tRAS and tWR
+
+		task PrechargeBank;
+			input [1:0] Bank;
+			begin
+				if(BankActive[Bank] == 1) begin
+					if(Now - LastActivate[Bank] < tRAS_ns) begin
+						$display("SDRAM ERROR @%0t: tRAS violated, bank %0d precharged %0dns after activate", Now, Bank, Now - LastActivate[Bank]);
+						Errors = Errors + 1;
+					end
+					if(Now - LastWrite[Bank] < tWR_ns) begin
+						$display("SDRAM ERROR @%0t: tWR violated, bank %0d precharged %0dns after write", Now, Bank, Now - LastWrite[Bank]);
+						Errors = Errors + 1;
+					end
+					BankActive[Bank] = 0;
+					LastPrecharge[Bank] = Now;
+				end
+			end
+		endtask
+
+		always@(posedge Clock) begin
+			Now = $time;
+			ClockPeriod = Now - LastEdge;
+			LastEdge = Now;
+			Cmd = {RAS_L, CAS_L, WE_L};
+
+			// output the next word of a read burst, it is driven just after this edge and sampled at the next
+
+			if(ReadActive_H == 1) begin
+				if(ReadDelay > 0)
+					ReadDelay = ReadDelay - 1;
+
+				if(ReadDelay == 0) begin
+					if(ReadIndex < ReadLimit) begin
+						DQOut <= #1 Mem[ReadSlot * 1024 + ((ReadCol & ~(BL - 1)) | ((ReadCol + ReadIndex) & (BL - 1)))];
+						DQOutEnable_H <= #1 1;
+						ReadIndex = ReadIndex + 1;
+					end
+					else begin
+						DQOutEnable_H <= #1 0;
+						ReadActive_H = 0;
+					end
+				end
+			end
+
+			// refresh interval
+
+			if(ModeSet_H == 1 && RefreshLate_H == 0 && Now - LastRefresh > (MaxPostponedRefreshes + 1) * tREFI_ns) begin
+				$display("SDRAM ERROR @%0t: no refresh for %0dns, more than %0d refreshes postponed", Now, Now - LastRefresh, MaxPostponedRefreshes);
+				Errors = Errors + 1;
+				RefreshLate_H = 1;
+			end
+
+			// new command
+
+			if(CKE_H === 1'b1 && CS_L === 1'b0 && Cmd != CmdNop) begin
+				if(PoweredUp_H == 0) begin
+					if(Now < tPowerUp_ns) begin
+						$display("SDRAM ERROR @%0t: command before the %0dns power up delay", Now, tPowerUp_ns);
+						Errors = Errors + 1;
+					end
+					PoweredUp_H = 1;
+				end
+
+				if(RefreshSeen_H == 1 && Now - LastRefresh < tRFC_ns) begin
+					$display("SDRAM ERROR @%0t: tRFC violated, command %0dns after refresh", Now, Now - LastRefresh);
+					Errors = Errors + 1;
+				end
+
+				if(ModeSet_H == 1 && Now - LastModeRegisterSet < 2 * ClockPeriod) begin
+					$display("SDRAM ERROR @%0t: tMRD violated, command 1 clock after mode register set", Now);
+					Errors = Errors + 1;
+				end
+
+				case(Cmd)
+					CmdActivate: begin
+						if(ModeSet_H == 0) begin
+							$display("SDRAM ERROR @%0t: activate before the mode register was set", Now);
+							Errors = Errors + 1;
+						end
+						if(BankActive[BA] == 1) begin
+							$display("SDRAM ERROR @%0t: activate to bank %0d which already has a row open", Now, BA);
+							Errors = Errors + 1;
+						end
+						if(Now < LastPrecharge[BA] + tRP_ns) begin
+							$display("SDRAM ERROR @%0t: tRP violated, bank %0d activated %0dns after precharge", Now, BA, Now - LastPrecharge[BA]);
+							Errors = Errors + 1;
+						end
+						if(Activates != 0 && Now - LastActivate[BA] < tRC_ns) begin
+							$display("SDRAM ERROR @%0t: tRC violated, bank %0d activated %0dns after last activate", Now, BA, Now - LastActivate[BA]);
+							Errors = Errors + 1;
+						end
+
+						FindRow(BA, Addr, Slot);
+						BankActive[BA] = 1;
+						ActiveSlot[BA] = Slot;
+						LastActivate[BA] = Now;
+						Activates = Activates + 1;
+					end
+
+					CmdRead, CmdWrite: begin
+						if(BankActive[BA] == 0) begin
+							$display("SDRAM ERROR @%0t: %s to bank %0d with no row open", Now, (Cmd == CmdRead) ? "read" : "write", BA);
+							Errors = Errors + 1;
+						end
+						else if(Now - LastActivate[BA] < tRCD_ns) begin
+							$display("SDRAM ERROR @%0t: tRCD violated, bank %0d accessed %0dns after activate", Now, BA, Now - LastActivate[BA]);
+							Errors = Errors + 1;
+						end
+
+						if(Cmd == CmdRead) begin
+							ReadActive_H = 1;
+							ReadDelay = CL - 1;
+							ReadIndex = 0;
+							ReadLimit = BL;
+							ReadSlot = ActiveSlot[BA];
+							ReadCol = Addr[9:0];
+							Reads = Reads + 1;
+
+							if(Addr[10] == 1) begin						// auto precharge starts once the burst has been read
+								BankActive[BA] = 0;
+								LastPrecharge[BA] = Now + BL * ClockPeriod;
+							end
+						end
+						else begin
+							if(DQOutEnable_H == 1) begin
+								$display("SDRAM ERROR @%0t: DQ bus contention, write while read data is being driven", Now);
+								Errors = Errors + 1;
+							end
+							if(SingleWrite_H == 0) begin
+								$display("SDRAM ERROR @%0t: burst writes are not modelled, set A9 in the mode register", Now);
+								Errors = Errors + 1;
+							end
+							if(DQM !== 2'b00 && DQM !== 2'b01 && DQM !== 2'b10) begin
+								$display("SDRAM ERROR @%0t: write with DQM = %b", Now, DQM);
+								Errors = Errors + 1;
+							end
+							if(^DQ === 1'bx) begin
+								$display("SDRAM ERROR @%0t: write data not driven (DQ = %h)", Now, DQ);
+								Errors = Errors + 1;
+							end
+
+							ReadActive_H = 0;									// a write ends any read burst
+							DQOutEnable_H <= #1 0;
+							if(DQM[1] == 0)
+								Mem[ActiveSlot[BA] * 1024 + Addr[9:0]][15:8] = DQ[15:8];
+							if(DQM[0] == 0)
+								Mem[ActiveSlot[BA] * 1024 + Addr[9:0]][7:0] = DQ[7:0];
+							LastWrite[BA] = Now;
+							Writes = Writes + 1;
+
+							if(Addr[10] == 1) begin						// auto precharge starts after tWR
+								BankActive[BA] = 0;
+								LastPrecharge[BA] = Now + tWR_ns;
+							end
+						end
+					end
+
+					CmdPrecharge: begin
+						if(Addr[10] == 1) begin
+							for(b = 0; b < 4; b = b + 1)
+								PrechargeBank(b);
+						end
+						else
+							PrechargeBank(BA);
+					end
+
+					CmdRefresh: begin
+						if(BankActive != 4'b0000) begin
+							$display("SDRAM ERROR @%0t: refresh with a bank open (%b)", Now, BankActive);
+							Errors = Errors + 1;
+						end
+						for(b = 0; b < 4; b = b + 1)
+							if(Now < LastPrecharge[b] + tRP_ns) begin
+								$display("SDRAM ERROR @%0t: tRP violated, refresh %0dns after bank %0d precharge", Now, Now - LastPrecharge[b], b);
+								Errors = Errors + 1;
+							end
+
+						if(ModeSet_H == 0)
+							InitialRefreshes = InitialRefreshes + 1;
+						else
+							Refreshes = Refreshes + 1;
+
+						LastRefresh = Now;
+						RefreshSeen_H = 1;
+						RefreshLate_H = 0;
+					end
+
+					CmdModeRegisterSet: begin
+						if(BankActive != 4'b0000) begin
+							$display("SDRAM ERROR @%0t: mode register set with a bank open", Now);
+							Errors = Errors + 1;
+						end
+						if(ModeSet_H == 0 && InitialRefreshes < MinInitialRefreshes) begin
+							$display("SDRAM ERROR @%0t: only %0d refreshes before the mode register was set", Now, InitialRefreshes);
+							Errors = Errors + 1;
+						end
+
+						CL = Addr[6:4];
+						BL = (Addr[2:0] == 3'b111) ? 1024 : (1 << Addr[2:0]);
+						SingleWrite_H = Addr[9];
+
+						if(CL != 2 && CL != 3) begin
+							$display("SDRAM ERROR @%0t: CAS latency %0d not supported", Now, CL);
+							Errors = Errors + 1;
+						end
+						else if((CL == 2 && ClockPeriod < tCK_CL2_ns) || (CL == 3 && ClockPeriod < tCK_CL3_ns)) begin
+							$display("SDRAM ERROR @%0t: CAS latency %0d too short for a %0dns clock", Now, CL, ClockPeriod);
+							Errors = Errors + 1;
+						end
+						if(Addr[2:0] > 3'b011 && Addr[2:0] != 3'b111 || Addr[3] == 1) begin
+							$display("SDRAM ERROR @%0t: burst mode %b not supported", Now, Addr[3:0]);
+							Errors = Errors + 1;
+						end
+
+						ModeSet_H = 1;
+						LastModeRegisterSet = Now;
+						LastRefresh = Now;								// refresh interval counted from the end of initialisation
+					end
+
+					CmdBurstStop: begin									// data already on its way (CAS latency - 1 words) still comes out
+						if(ReadActive_H == 1 && ReadIndex + CL - 2 < ReadLimit)
+							ReadLimit = ReadIndex + CL - 2;
+					end
+				endcase
+			end
+		end
+
+		// summary for the testbench, with the average refresh rate check
+
+		task Report;
+			integer Needed;
+			begin
+				Needed = (Now - LastModeRegisterSet) / tREFI_ns;					// time is unsigned, subtract as an integer
+				Needed = Needed - MaxPostponedRefreshes;
+				if(ModeSet_H == 1 && Refreshes < Needed) begin
+					$display("SDRAM ERROR @%0t: %0d refreshes since initialisation, at least %0d needed", Now, Refreshes, Needed);
+					Errors = Errors + 1;
+				end
+
+				$display("SDRAM: %0d activates, %0d reads, %0d writes, %0d refreshes (%0d during initialisation), %0d timing/protocol errors",
+							Activates, Reads, Writes, Refreshes, InitialRefreshes, Errors);
+			end
+		endtask
+endmodule
@@ -50,6 +50,12 @@
 #define Timer4Control   *(volatile unsigned char *)(0x0040003E)
 #define Timer4Status    *(volatile unsigned char *)(0x0040003E)
 
+// Timer 1 is used by the monitor as a tick for measuring how long tests take
+// Timers 1-4 share the level 3 IRQ (vector 27)
+#define TimerIRQVector  27
+#define TimerTickData   0x0A        // a coarse tick, so the level 3 ISR (which saves every register) takes little of the CPU
+#define CalibrationChars 2304       // NULs sent to time the tick against the ACIA, 200ms at 115200 baud
+
 /*********************************************************************************************
 **	RS232 port addresses
 *********************************************************************************************/
@@ -60,6 +66,18 @@
 #define RS232_RxData      *(volatile unsigned char *)(0x00400042)
 #define RS232_Baud        *(volatile unsigned char *)(0x00400044)
 
+// baud rate generator codes for RS232_Baud, all others = 9600
+#define Baud230k            0
+#define Baud115k            1
+#define Baud57k6            2
+#define Baud38k4            3
+#define Baud19k2            4
+#define Baud9600            5
+#define InteractiveBaudCode Baud115k    // safe rate used for the command line, downloads may use a faster negotiated rate
+
+#define NegotiateBlockSize  64          // characters echoed back to the host to prove a new baud rate works
+#define NegotiateBlocks     3           // number of blocks that must all pass before a rate is accepted
+
 /*********************************************************************************************
 **	PIA 1 and 2 port addresses
 *********************************************************************************************/
@@ -112,6 +130,76 @@
 #define SPER_ICNT 0xC0
 #define SPER_ESPR 0x03
 
+/*************************************************************
+** Memory BIST registers (lab2/M68kMemoryBist_Verilog.v)
+**************************************************************/
+#define BistControl         (*(volatile unsigned short *)(0x00408100))    // write
+#define BistStatus          (*(volatile unsigned short *)(0x00408100))    // read
+#define BistStartHi         (*(volatile unsigned short *)(0x00408102))
+#define BistStartLo         (*(volatile unsigned short *)(0x00408104))
+#define BistEndHi           (*(volatile unsigned short *)(0x00408106))
+#define BistEndLo           (*(volatile unsigned short *)(0x00408108))
+#define BistFailCount       (*(volatile unsigned short *)(0x0040810A))
+#define BistFailAddrHi(n)   (*(volatile unsigned short *)(0x00408110 + 8 * (n)))
+#define BistFailAddrLo(n)   (*(volatile unsigned short *)(0x00408112 + 8 * (n)))
+#define BistFailSyndrome(n) (*(volatile unsigned short *)(0x00408114 + 8 * (n)))
+#define BistFailExpected(n) (*(volatile unsigned short *)(0x00408116 + 8 * (n)))
+#define BistNumFailEntries  4
+
+// control/status register bits
+#define BIST_START      0x0001
+#define BIST_BUSY       0x0001
+#define BIST_IRQEN      0x0002
+#define BIST_PATTERN    0x000C      // 00 = address in data, 01 = checkerboard, 10 = walking ones
+#define BIST_CLEARDONE  0x0010
+#define BIST_DONE       0x0080
+#define BIST_FAILED     0x0100
+
+// BistIrq_L drives IRQ6_L, so the end of a run interrupts on level 6 (autovector 30)
+#define BistIRQVector   30
+
+// give up on a BIST run after this long per byte tested plus a second, a 4 element march
+// makes 3 accesses per byte so this allows ~650ns an access, several times what the controller needs
+#define BistTimeoutnsPerByte    2000
+
+/*************************************************************
+** Dram controller performance counters (lab2/M68kDramController_Verilog.v)
+**************************************************************/
+#define DramPerfCounterHi(n)    (*(volatile unsigned short *)(0x00408080 + 4 * (n)))
+#define DramPerfCounterLo(n)    (*(volatile unsigned short *)(0x00408082 + 4 * (n)))
+#define DramPerfControl         (*(volatile unsigned short *)(0x004080A0))
+#define DramPerfNumCounters     8
+
+// control register bits
+#define PERF_CLEAR      0x0001
+#define PERF_ENABLE     0x0002
+
+// counter numbers
+#define PERF_CYCLES         0
+#define PERF_READS          1
+#define PERF_WRITES         2
+#define PERF_ACTIVATES      3
+#define PERF_ROWHITS        4
+#define PERF_ROWCONFLICTS   5
+#define PERF_REFRESHSTALLS  6
+#define PERF_DTACKWAITS     7
+
+/*************************************************************
+** Associative cache flush (lab4/512kb_set_associative_cache_project)
+** OutPortC[0] drives FlushCache_H, InPortC[0] reads back FlushBusy_H
+**************************************************************/
+#define CacheFlushPort          PortC
+#define CACHE_FLUSH             0x01
+#define CacheFlushTimeoutms     10          // 32 dirty lines write back in well under 1ms
+
+/*************************************************************
+** Cache prefetch counters (lab4/32_line and 512_line cache projects)
+** OutPortD[1..0] selects a byte of the counters, InPortD reads it back
+**************************************************************/
+#define PrefetchCounterPort     PortD
+#define PREFETCH_COUNT          0           // byte select of bits 7-0, bits 15-8 are the next byte
+#define PREFETCH_HITS           2
+
 /*************************************************************
 ** Flash Commands
 **************************************************************/
@@ -122,6 +210,17 @@
 #define FLASH_GET_STATUS_REGISTER1 0x05
 #define FLASH_GET_MANUFACTURER_ID 0x90
 
+#define FlashPageSize           256         // bytes programmed by one page program command
+#define FlashSectorSize         4096        // bytes cleared by one sector erase command
+#define NumFlashProgramSectors  ((FlashSize + 1) / FlashSectorSize)     // 4k sectors holding the 256k user program
+#define FlashConfigAddress      (FlashSize + 1)                         // 1st sector after the user program holds saved monitor settings
+#define FlashConfigMagic        0x42415544                              // "BAUD" marks a valid saved download baud rate
+
+/*************************************************************
+** RS232 receive buffer used while the flash chip is busy
+**************************************************************/
+#define RxBufferSize            16384       // must be a power of 2, big enough to hold characters arriving during a sector erase
+
 /********************************************************************************************
 **	RGB Colours
 *********************************************************************************************/
@@ -138,6 +237,17 @@
 
 #define DramStart               0x08000000
 #define DramEnd                 0x0BFFFFFF  // 64MB on DE1-soc
+#define DramUncachedOffset      0x04000000  // Dram is also decoded at 0C000000 - 0FFFFFFF, accesses there bypass the cache
+#define MonitorDataStart        0x0B000000  // monitor vector table, variables and heap, never touched by the march test
+#define MonitorDataEnd          0x0B0FFFFF
+#define MonitorStackStart       0x0BF00000  // monitor/user stacks growing down from TopOfStack
+#define MonitorStackEnd         0x0BFFFFFF
+#define MarchMaxFailures        16          // number of failing addresses printed before the rest are only counted
+#define PostStride              0x00010000  // POST checks one long word every 64KB
+#define PostNumAddressLines     24          // address lines A2-A25 checked by the POST
+#define BenchBuffer             0x09000000  // 'TB' test buffer, clear of the user program and the monitor areas
+#define BenchMaxSize            0x02000000  // 32MB, up to MonitorDataStart
+#define BenchMinTime            500000      // micro seconds each benchmark test runs for
 #define ProgramStart            0x08000000
 #define ProgramEnd              0x0803FFFF  // 256Kbytes
 #define Num_FlashSectors        ((ProgramEnd - ProgramStart)/65536)
@@ -193,8 +303,16 @@ void EraseSPIFlashSector(int SectorNumber) ;
 
 // other prototypes
 void Init_RS232(void) ;
+void SetBaudRate(int BaudCode) ;
+int  GetCharWithTimeout(int TimeOutms) ;
+void NegotiateBaudRate(void) ;
+int  StartDownloadBaudRate(void) ;
+void EndDownloadBaudRate(int Switched) ;
+void LoadDownloadBaudRate(void) ;
 int kbhit(void) ;
 void Load_SRecordFile(void) ;
+void Load_SRecordFileToFlash(void) ;
+void PollRS232(void) ;
 void DumpMemory(void) ;
 void EnterString(void) ;
 void FillMemory(void) ;
@@ -204,6 +322,25 @@ void LoadFromFlashChip(void);
 void DumpRegisters(void) ;
 void DumpRegistersandPause(void) ;
 void ChangeRegisters(void);
+void MarchTest(int MarchType) ;
+void HardwareMemoryTest(void) ;
+void MemoryBenchmark(void) ;
+void DramCountersGo(void) ;
+void DramCountersDisplay(void) ;
+void DramCountersStopped(void) ;
+void FlushCache(void) ;
+void PrefetchCountersDisplay(void) ;
+int  PowerOnSelfTest(void) ;
+void PostLCDMessage(int BadBanks) ;
+unsigned int MulDiv(unsigned int a, unsigned int b, unsigned int c) ;
+
+// timer tick used to time tests
+void SetInterruptMask(int Mask) ;           // in cstart, sets the IRQ mask bits of the status register
+void StartTickTimer(void) ;
+unsigned int StopTickTimer(void) ;
+void CalibrateTickTimer(void) ;
+unsigned int TicksTous(unsigned int Ticks) ;
+unsigned int TicksToCPUus(unsigned int Ticks) ;
 
 void Out1Hex(int c) ;
 void Out2Hex(int c) ;
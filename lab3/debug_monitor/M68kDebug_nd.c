@@ -32,6 +32,22 @@ char WatchPointString[8][100] ;
 
 char    TempString[100] ;
 
+// receive buffer for characters arriving while the debugger is busy talking to the flash chip
+unsigned char RxBuffer[RxBufferSize] ;
+unsigned int RxHead, RxTail ;                           // RxHead = next free slot, RxTail = oldest unread character
+int     RxPolling, RxOverrun ;                          // RxPolling set when SPI/flash waits should collect serial characters
+
+int     DownloadBaudCode ;                              // baud rate code used for 'L' and 'Q' downloads (see NegotiateBaudRate())
+
+volatile unsigned int TickCount ;                       // incremented by the Timer 1 interrupt while timing a test
+volatile int BistFinished ;                             // set by the BIST interrupt at the end of a run
+unsigned int TickPeriodns ;                             // measured length of a tick in nano seconds, 0 until calibrated
+unsigned int TickCPUns ;                                // the part of a tick left to the program, i.e. less the tick ISR
+unsigned int MarchFailures ;                            // failures found by the current march test
+unsigned int PostSaved[(DramEnd - DramStart + 1) / PostStride] ;   // Dram contents under the POST's sparse pattern
+
+int     DramProfiling ;                                 // user program started by 'TP', show the Dram counters when it stops
+
 /************************************************************************************
 *Subroutine to give the 68000 something useless to do to waste 1 mSec
 ************************************************************************************/
@@ -168,6 +184,28 @@ void Init_RS232(void)
     RS232_Baud = (char)(0x1) ;      // program baud rate generator 000 = 230k, 001 = 115k, 010 = 57.6k, 011 = 38.4k, 100 = 19.2, all others = 9600
 }
 
+/*********************************************************************************************
+*Change the baud rate once the last character has left the transmitter
+*********************************************************************************************/
+void SetBaudRate(int BaudCode)
+{
+    while(((char)(RS232_Status) & (char)(0x02)) != (char)(0x02))    // wait for Tx data register to empty
+        ;
+
+    Wait3ms() ;                         // and for the last character to be shifted out, even at 9600 baud
+    RS232_Baud = (char)(BaudCode) ;
+}
+
+long int BaudCodeToRate(int BaudCode)
+{
+    if(BaudCode == Baud230k)        return 230400 ;
+    else if(BaudCode == Baud115k)   return 115200 ;
+    else if(BaudCode == Baud57k6)   return 57600 ;
+    else if(BaudCode == Baud38k4)   return 38400 ;
+    else if(BaudCode == Baud19k2)   return 19200 ;
+    else                            return 9600 ;
+}
+
 int kbhit(void)
 {
     if(((char)(RS232_Status) & (char)(0x01)) == (char)(0x01))    // wait for Rx bit in status register to be '1'
@@ -176,6 +214,24 @@ int kbhit(void)
         return 0 ;
 }
 
+/*********************************************************************************************************
+**  The 6850 only holds 1 received character, so anything that keeps the CPU busy for longer than
+**  one character time (e.g. programming a flash page or erasing a sector) will lose data during a download.
+**  When RxPolling is set, the SPI/flash wait loops call this to move any received character into RxBuffer
+**  where _getch() will find it later
+*********************************************************************************************************/
+
+void PollRS232(void)
+{
+    if(RxPolling && kbhit()) {
+        RxBuffer[RxHead] = (RS232_RxData & (char)(0x7f)) ;
+        RxHead = (RxHead + 1) & (RxBufferSize - 1) ;
+
+        if(RxHead == RxTail)                                    // buffer has wrapped onto unread data
+            RxOverrun = 1 ;
+    }
+}
+
 /*********************************************************************************************************
 **  Subroutine to provide a low level output function to 6850 ACIA
 **  This routine provides the basic functionality to output a single character to the serial Port
@@ -208,10 +264,17 @@ int _putch( int c)
 int _getch( void )
 {
     int c ;
-    while(((char)(RS232_Status) & (char)(0x01)) != (char)(0x01))    // wait for Rx bit in 6850 serial comms chip status register to be '1'
-        ;
 
-    c = (RS232_RxData & (char)(0x7f));                   // read received character, mask off top bit and return as 7 bit ASCII character
+    if(RxHead != RxTail) {                               // characters collected by PollRS232() must be read first to keep them in order
+        c = RxBuffer[RxTail] ;
+        RxTail = (RxTail + 1) & (RxBufferSize - 1) ;
+    }
+    else {
+        while(((char)(RS232_Status) & (char)(0x01)) != (char)(0x01))    // wait for Rx bit in 6850 serial comms chip status register to be '1'
+            ;
+
+        c = (RS232_RxData & (char)(0x7f));               // read received character, mask off top bit and return as 7 bit ASCII character
+    }
 
     // shall we echo the character? Echo is set to TRUE at reset, but for speed we don't want to echo when downloading code with the 'L' debugger command
     if(Echo)
@@ -222,10 +285,26 @@ int _getch( void )
 
 // flush the input stream for any unread characters
 
+// wait for up to TimeOutms for a character, return it or -1 if nothing arrived (no echo)
+
+int GetCharWithTimeout(int TimeOutms)
+{
+    int i ;
+
+    while(TimeOutms-- > 0) {
+        for(i = 0; i < 1000; i ++)      // about 1ms, like Wait1ms()
+            if(kbhit())
+                return (RS232_RxData & (char)(0x7f)) ;
+    }
+    return -1 ;
+}
+
 void FlushKeyboard(void)
 {
     char c ;
 
+    RxTail = RxHead ;                   // throw away anything collected in the receive buffer too
+
     while(1)    {
         if(((char)(RS232_Status) & (char)(0x01)) == (char)(0x01))    // if Rx bit in status register is '1'
             c = ((char)(RS232_RxData) & (char)(0x7f)) ;
@@ -332,7 +411,7 @@ void FillMemory()
 void Load_SRecordFile()
 {
     int i, Address, AddressSize, DataByte, NumDataBytesToRead, LoadFailed, FailedAddress, AddressFail, SRecordCount = 0, ByteTotal = 0 ;
-    int result, ByteCount ;
+    int result, ByteCount, BaudSwitched ;
 
     char c, CheckSum, ReadCheckSum, HeaderType ;
     char *RamPtr ;                          // pointer to Memory where downloaded program will be stored
@@ -342,14 +421,18 @@ void Load_SRecordFile()
     Echo = 0 ;                              // don't echo S records during download
 
     printf("\r\nUse HyperTerminal to Send Text File (.hex)\r\n") ;
+    BaudSwitched = StartDownloadBaudRate() ;
 
     while(1)    {
         CheckSum = 0 ;
         do {
             c = toupper(_getch()) ;
 
-            if(c == 0x1b )      // if break
+            if(c == 0x1b ) {    // if break
+                EndDownloadBaudRate(BaudSwitched) ;
+                Echo = 1 ;
                 return;
+            }
          }while(c != (char)('S'));   // wait for S start of header
 
         HeaderType = _getch() ;
@@ -407,6 +490,15 @@ void Load_SRecordFile()
             putchar('.') ;
      }
 
+     // pause at the end to wait for download to finish transmitting at the end of S8 etc
+     // then go back to the interactive baud rate before reporting the result
+
+     for(i = 0; i < 400000; i ++)
+        ;
+
+     FlushKeyboard() ;
+     EndDownloadBaudRate(BaudSwitched) ;
+
      if(LoadFailed == 1) {
         printf("\r\nLoad Failed at Address = [$%08X]\r\n", FailedAddress) ;
      }
@@ -414,12 +506,6 @@ void Load_SRecordFile()
      else
         printf("\r\nSuccess: Downloaded %d bytes\r\n", ByteTotal) ;
 
-     // pause at the end to wait for download to finish transmitting at the end of S8 etc
-
-     for(i = 0; i < 400000; i ++)
-        ;
-
-     FlushKeyboard() ;
      Echo = 1;
 }
 
@@ -501,7 +587,8 @@ void SPI_Init(void)
 void WaitForSPITransmitComplete(void)
 {
     // TODO : poll the status register SPIF bit looking for completion of transmission
-    while(!TestForSPITransmitDataComplete());
+    while(!TestForSPITransmitDataComplete())
+        PollRS232() ;                   // don't lose serial characters if a download is running while we talk to the flash chip
 
     // once transmission is complete, clear the write collision and interrupt on transmit complete flags in the status register (read documentation)
     // just in case they were set
@@ -731,6 +818,360 @@ void LoadFromFlashChip(void)
 
 }
 
+/*************************************************************************
+** Program one page collected during a download into the flash chip.
+** The sector holding the page is erased the first time it is used.
+** Only the bytes marked in pageUsed are verified, the rest were left
+** at 0xFF so programming them leaves the flash unchanged.
+** Returns -1 on success, otherwise the byte index that failed to verify
+**************************************************************************/
+int flashProgramCollectedPage(unsigned int pageAddress, unsigned char *pageBuf, unsigned char *pageUsed, unsigned char *sectorErased)
+{
+    unsigned int i, sectorNum = pageAddress / FlashSectorSize;
+    unsigned char readBuf[FlashPageSize];
+    int result = -1;
+
+    if(sectorErased[sectorNum] == 0) {
+        flashEraseSector(sectorNum * FlashSectorSize);
+        sectorErased[sectorNum] = 1;
+    }
+
+    flashWritePage(pageAddress, pageBuf);
+    flashRead(pageAddress, readBuf, FlashPageSize);
+
+    for(i = 0; i < FlashPageSize; i++) {
+        if(pageUsed[i] && readBuf[i] != pageBuf[i] && result == -1)
+            result = i;
+
+        pageBuf[i] = 0xFF;              // get ready for the next page
+        pageUsed[i] = 0;
+    }
+
+    return result;
+}
+
+/*************************************************************************
+** Download an S record file straight into the SPI flash chip
+**
+** Records are collected into a 256 byte page buffer. As soon as a record
+** moves on to a different page, the finished page is programmed while
+** PollRS232() keeps collecting the characters that arrive in the meantime,
+** so the download and the flash programming overlap. A copy is also left
+** in Dram so the program can be run straight away with 'G'
+**************************************************************************/
+void Load_SRecordFileToFlash(void)
+{
+    int i, Address, AddressSize, DataByte, NumDataBytesToRead, LoadFailed, FailedAddress, SRecordCount = 0, ByteTotal = 0, PageTotal = 0 ;
+    int ByteCount, FlashAddress, result, BaudSwitched ;
+    int PageAddress = -1 ;                  // flash address of the page being collected, -1 when no page is open
+
+    char c, CheckSum, ReadCheckSum, HeaderType ;
+    char *RamPtr ;
+    unsigned char pageBuf[FlashPageSize], pageUsed[FlashPageSize], sectorErased[NumFlashProgramSectors] ;
+
+    LoadFailed = 0 ;
+    Echo = 0 ;                              // don't echo S records during download
+    RxOverrun = 0 ;
+
+    for(i = 0; i < FlashPageSize; i ++) {
+        pageBuf[i] = 0xFF ;
+        pageUsed[i] = 0 ;
+    }
+
+    for(i = 0; i < NumFlashProgramSectors; i ++)
+        sectorErased[i] = 0 ;
+
+    printf("\r\nUse HyperTerminal to Send Text File (.hex) to Flash\r\n") ;
+    BaudSwitched = StartDownloadBaudRate() ;
+    RxPolling = 1 ;
+
+    while(1)    {
+        CheckSum = 0 ;
+        do {
+            c = toupper(_getch()) ;
+
+            if(c == 0x1b ) {        // if break
+                RxPolling = 0 ;
+                EndDownloadBaudRate(BaudSwitched) ;
+                Echo = 1 ;
+                return;
+            }
+         }while(c != (char)('S'));   // wait for S start of header
+
+        HeaderType = _getch() ;
+
+        if(HeaderType == (char)('0') || HeaderType == (char)('5'))       // ignore s0, s5 records
+            continue ;
+
+        if(HeaderType >= (char)('7'))
+            break ;                 // end load on s7,s8,s9 records
+
+        ByteCount = Get2HexDigits(&CheckSum) ;
+
+        if(HeaderType == (char)('1')) {
+            AddressSize = 2 ;
+            Address = Get4HexDigits(&CheckSum);
+        }
+        else if (HeaderType == (char)('2')) {
+            AddressSize = 3 ;
+            Address = Get6HexDigits(&CheckSum) ;
+        }
+        else    {
+            AddressSize = 4 ;
+            Address = Get8HexDigits(&CheckSum) ;
+        }
+
+        RamPtr = (char *)(Address) ;
+        NumDataBytesToRead = ByteCount - AddressSize - 1 ;
+
+        for(i = 0; i < NumDataBytesToRead; i ++) {
+            DataByte = Get2HexDigits(&CheckSum) ;
+            *RamPtr++ = DataByte ;
+
+            FlashAddress = Address + i - ProgramStart ;
+            if(FlashAddress < 0 || FlashAddress > FlashSize) {         // the flash only holds the 256k program area
+                LoadFailed = 2 ;
+                FailedAddress = Address + i ;
+                continue ;
+            }
+
+            // moved on to a new page so program the one we have just finished
+            if((FlashAddress & ~(FlashPageSize - 1)) != PageAddress) {
+                if(PageAddress != -1) {
+                    result = flashProgramCollectedPage(PageAddress, pageBuf, pageUsed, sectorErased) ;
+                    PageTotal ++ ;
+                    if(result != -1 && LoadFailed == 0) {
+                        LoadFailed = 3 ;
+                        FailedAddress = ProgramStart + PageAddress + result ;
+                    }
+                }
+                PageAddress = FlashAddress & ~(FlashPageSize - 1) ;
+            }
+
+            pageBuf[FlashAddress & (FlashPageSize - 1)] = DataByte ;
+            pageUsed[FlashAddress & (FlashPageSize - 1)] = 1 ;
+            ByteTotal++;
+        }
+
+        ReadCheckSum = Get2HexDigits(0) ;
+
+        if((~CheckSum&0Xff) != (ReadCheckSum&0Xff))   {
+            LoadFailed = 1 ;
+            FailedAddress = Address ;
+            break;
+        }
+
+        SRecordCount++ ;
+
+        if(SRecordCount % 25 == 0)
+            putchar('.') ;
+    }
+
+    // program whatever is left in the last page
+    if(PageAddress != -1 && LoadFailed != 1) {
+        result = flashProgramCollectedPage(PageAddress, pageBuf, pageUsed, sectorErased) ;
+        PageTotal ++ ;
+        if(result != -1 && LoadFailed == 0) {
+            LoadFailed = 3 ;
+            FailedAddress = ProgramStart + PageAddress + result ;
+        }
+    }
+
+    // erase the sectors the new image did not touch, LoadFromFlashChip() copies the whole program area
+    // at boot and would otherwise pick up what is left of the last (bigger) program
+    if(LoadFailed != 1) {
+        for(i = 0; i < NumFlashProgramSectors; i ++) {
+            if(sectorErased[i] == 0) {
+                flashEraseSector(i * FlashSectorSize) ;
+                sectorErased[i] = 1 ;
+            }
+        }
+    }
+
+    for(i = 0; i < 400000; i ++)
+        PollRS232() ;
+
+    RxPolling = 0 ;
+    FlushKeyboard() ;
+    EndDownloadBaudRate(BaudSwitched) ;
+
+    if(RxOverrun)
+        printf("\r\nLoad Failed: Receive buffer overrun while programming Flash\r\n") ;
+    else if(LoadFailed == 1)
+        printf("\r\nLoad Failed at Address = [$%08X]\r\n", FailedAddress) ;
+    else if(LoadFailed == 2)
+        printf("\r\nLoad Failed: Address [$%08X] is outside the Flash program area [$%08X - $%08X]\r\n", FailedAddress, ProgramStart, ProgramEnd) ;
+    else if(LoadFailed == 3)
+        printf("\r\nFlash Verify Failed at Address = [$%08X]\r\n", FailedAddress) ;
+    else
+        printf("\r\nSuccess: Programmed %d bytes into %d Flash pages\r\n", ByteTotal, PageTotal) ;
+
+    Echo = 1;
+}
+
+/*************************************************************************
+** Baud rate negotiation with the host loader ('N' command)
+**
+** The monitor always talks to the user at InteractiveBaudCode, but a
+** download can run faster if the host loader and the cable can cope.
+** The host end is lab3/host_loader/m68k_loader.py, which is also a plain
+** terminal and sends the .hex file for 'L' and 'Q'. The protocol, all
+** characters 7 bit ASCII:
+**
+**  1. monitor sends "~B<code>\r\n" (switch) or "~T<code>\r\n" (switch and
+**     test) where <code> is a digit '0'-'5' (RS232_Baud)
+**  2. host replies '+' at the current rate, then both ends switch to <code>
+**  3. for ~T only, the monitor waits 100ms then sends NegotiateBlocks blocks
+**     of NegotiateBlockSize characters, the host echoes each one straight back
+**  4. if every echo matched, the monitor sends '+' and the rate is accepted,
+**     otherwise both ends go back to the last rate that worked (the host
+**     does this when it sees nothing for half a second)
+**
+** ~B is used around a download, ~T only by 'N'.
+**
+** Faster rates are tried until one fails, the fastest good one becomes
+** DownloadBaudCode and is saved in the flash config sector so 'L' and 'Q'
+** use it in the next session as well. A plain terminal never replies '+'
+** so nothing changes if the host loader is not running.
+**************************************************************************/
+
+// ask the host to move to a new rate (and get ready for TestBaudRate() if Test is set), returns 1 if it agreed
+
+int RequestBaudRate(int BaudCode, int Test)
+{
+    int c ;
+
+    FlushKeyboard() ;
+    printf("~%c%d\r\n", Test ? 'T' : 'B', BaudCode) ;
+
+    do {
+        c = GetCharWithTimeout(2000) ;
+    }while(c != -1 && c != '+') ;
+
+    if(c != '+')
+        return 0 ;
+
+    SetBaudRate(BaudCode) ;
+    return 1 ;
+}
+
+// echo test at the current rate, returns 1 if every character came back correctly
+
+int TestBaudRate(void)
+{
+    int i, j, c ;
+
+    for(i = 0; i < 100; i ++)       // give the host time to reprogram its uart
+        Wait1ms() ;
+
+    while(kbhit())                  // discard anything received during the switch
+        c = RS232_RxData ;
+
+    for(j = 0; j < NegotiateBlocks; j ++) {
+        for(i = 0; i < NegotiateBlockSize; i ++) {
+            c = (i * 37 + j + 0x55) & 0x7f ;    // spread over the 7 bit codes, but '~' starts a loader command
+            if(c == '~')
+                c = 0x55 ;
+
+            putchar(c) ;
+            if(GetCharWithTimeout(50) != c)
+                return 0 ;
+        }
+    }
+
+    putchar('+') ;
+    return 1 ;
+}
+
+int StartDownloadBaudRate(void)
+{
+    if(DownloadBaudCode == InteractiveBaudCode)
+        return 0 ;
+
+    if(RequestBaudRate(DownloadBaudCode, 0) == 0) {
+        printf("\r\nHost loader not responding: Downloading at %ld baud\r\n", BaudCodeToRate(InteractiveBaudCode)) ;
+        return 0 ;
+    }
+    return 1 ;
+}
+
+void EndDownloadBaudRate(int Switched)
+{
+    if(Switched == 0)
+        return ;
+
+    if(RequestBaudRate(InteractiveBaudCode, 0) == 0)
+        SetBaudRate(InteractiveBaudCode) ;    // switch anyway, the user can always reset the host end
+}
+
+void SaveDownloadBaudRate(void)
+{
+    int i ;
+    unsigned char pageBuf[FlashPageSize] ;
+
+    for(i = 0; i < FlashPageSize; i ++)
+        pageBuf[i] = 0xFF ;
+
+    pageBuf[0] = (unsigned char)(FlashConfigMagic >> 24) ;
+    pageBuf[1] = (unsigned char)(FlashConfigMagic >> 16) ;
+    pageBuf[2] = (unsigned char)(FlashConfigMagic >> 8) ;
+    pageBuf[3] = (unsigned char)(FlashConfigMagic) ;
+    pageBuf[4] = (unsigned char)(DownloadBaudCode) ;
+
+    flashEraseSector(FlashConfigAddress) ;
+    flashWritePage(FlashConfigAddress, pageBuf) ;
+}
+
+// read the saved download rate, use the interactive rate if nothing valid has been saved
+
+void LoadDownloadBaudRate(void)
+{
+    unsigned char buf[5] ;
+    unsigned int magic ;
+
+    DownloadBaudCode = InteractiveBaudCode ;
+    flashRead(FlashConfigAddress, buf, 5) ;
+
+    magic = ((unsigned int)(buf[0]) << 24) | ((unsigned int)(buf[1]) << 16) | ((unsigned int)(buf[2]) << 8) | buf[3] ;
+    if(magic == FlashConfigMagic && buf[4] <= Baud9600)
+        DownloadBaudCode = buf[4] ;
+}
+
+void NegotiateBaudRate(void)
+{
+    int i, BaudCode, GoodCode ;
+
+    printf("\r\nNegotiating Download Baud Rate with Host Loader.....\r\n") ;
+
+    if(RequestBaudRate(InteractiveBaudCode, 1) == 0) {  // make sure a loader is listening before changing anything
+        printf("\r\nHost loader not responding: Download Baud Rate unchanged at %ld", BaudCodeToRate(DownloadBaudCode)) ;
+        return ;
+    }
+
+    GoodCode = InteractiveBaudCode ;
+    if(TestBaudRate()) {
+        for(BaudCode = InteractiveBaudCode - 1; BaudCode >= Baud230k; BaudCode --) {
+            if(RequestBaudRate(BaudCode, 1) == 0)
+                break ;
+
+            if(TestBaudRate() == 0) {
+                SetBaudRate(GoodCode) ;                 // host goes back on its own when it doesn't see '+'
+                for(i = 0; i < 1000; i ++)
+                    Wait1ms() ;
+                break ;
+            }
+            GoodCode = BaudCode ;
+        }
+    }
+
+    if(GoodCode != InteractiveBaudCode)
+        RequestBaudRate(InteractiveBaudCode, 0) ;       // back to the safe rate for the command line
+
+    DownloadBaudCode = GoodCode ;
+    SaveDownloadBaudRate() ;
+    printf("\r\nDownload Baud Rate set to %ld (Interactive %ld)", BaudCodeToRate(DownloadBaudCode), BaudCodeToRate(InteractiveBaudCode)) ;
+}
+
 
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1325,12 +1766,19 @@ void Help(void)
     printf("\r\n  G            - Go Program Starting at Address: $%08X", PC) ;
     printf("\r\n  L            - Load Program (.HEX file) from Laptop") ;
     printf("\r\n  M            - Memory Examine and Change");
+    printf("\r\n  N            - Negotiate fastest Download Baud Rate with Host Loader") ;
     printf("\r\n  P            - Program Flash Memory with User Program") ;
+    printf("\r\n  Q            - Load Program (.HEX file) from Laptop straight into Flash") ;
     printf("\r\n  R            - Display 68000 Registers") ;
     printf("\r\n  S            - Toggle ON/OFF Single Step Mode") ;
-    printf("\r\n  TM           - Test Memory") ;
+    printf("\r\n  TM           - Test Memory: Write/Read Back, March C-, MATS+ or Hardware BIST") ;
     printf("\r\n  TS           - Test Switches: SW7-0") ;
     printf("\r\n  TD           - Test Displays: LEDs and 7-Segment") ;
+    printf("\r\n  TB           - Test Memory Bandwidth and Latency") ;
+    printf("\r\n  TP           - Go Program with Dram Performance Counters") ;
+    printf("\r\n  TC           - Display/Clear Dram Performance Counters") ;
+    printf("\r\n  TF           - Flush the Cache: write back dirty lines and invalidate") ;
+    printf("\r\n  TA           - Display Cache Prefetch Accuracy") ;
     printf("\r\n  WD/WS/WC/WK  - Watch Point: Display/Set/Clear/Kill") ;
     printf(banner) ;
 }
@@ -1340,6 +1788,8 @@ void menu(void)
 {
     char c,c1 ;
 
+    DramCountersStopped() ;             // back from a 'TP' run
+
     while(1)    {
         FlushKeyboard() ;               // dump unread characters from keyboard
         printf("\r\n#") ;
@@ -1367,12 +1817,18 @@ void menu(void)
         else if( c == (char)('M'))           // memory examine and modify
              MemoryChange() ;
 
+        else if( c == (char)('N'))            // negotiate download baud rate, the host end is lab3/host_loader/m68k_loader.py
+             NegotiateBaudRate() ;
+
         else if( c == (char)('P'))            // Program Flash Chip
              ProgramFlashChip() ;
 
         else if( c == (char)('C'))             // copy flash chip to ram and go
              LoadFromFlashChip();
 
+        else if( c == (char)('Q'))             // load s record file straight into flash chip
+             Load_SRecordFileToFlash();
+
         else if( c == (char)('R'))             // dump registers
              DumpRegisters() ;
 
@@ -1390,6 +1846,16 @@ void menu(void)
                 SwitchTest() ;
              else if( c1 == (char)('D'))              // display Test command
                 TestLEDS() ;
+             else if( c1 == (char)('B'))              // memory benchmark
+                MemoryBenchmark() ;
+             else if( c1 == (char)('P'))              // go with Dram performance counters
+                DramCountersGo() ;
+             else if( c1 == (char)('C'))              // display/clear Dram performance counters
+                DramCountersDisplay() ;
+             else if( c1 == (char)('F'))              // flush the cache
+                FlushCache() ;
+             else if( c1 == (char)('A'))              // cache prefetch counters
+                PrefetchCountersDisplay() ;
              else
                 UnknownCommand() ;
         }
@@ -1615,6 +2081,779 @@ int get_data_pattern(unsigned int *pattern, unsigned int width_option)
     return 0;
 }
 
+/*******************************************************************************************
+** Timer 1 tick, used to time memory tests and benchmarks
+** Timer 1 interrupts on level 3 every tick and the monitor normally runs with
+** all interrupts masked, so the mask is lowered only while something is being timed
+**
+** The monitor does not know the clock Timer 1 counts, and the timer only starts its next
+** period when the ISR reloads it, so the tick is measured rather than assumed: the first
+** time something is timed, CalibrationChars NULs are sent back to back through the ACIA.
+** Each takes exactly 10 bit times (8 data bits, start and stop) at the interactive baud
+** rate, so the ticks counted meanwhile give TickPeriodns to within half a percent.
+** The CPU spins waiting for the transmitter, and comparing the spins with and without the
+** tick running gives the share of each tick the ISR takes, so benchmarks can leave it out
+*******************************************************************************************/
+
+void TimerTickISR(void)
+{
+    if(Timer1Status == 1) {         // did Timer 1 produce the interrupt
+        Timer1Control = 3 ;         // reset the timer to clear the interrupt and let it run again
+        TickCount ++ ;
+    }
+}
+
+void RunTickTimer(void)
+{
+    TickCount = 0 ;
+    InstallExceptionHandler(TimerTickISR, TimerIRQVector) ;
+    Timer1Data = TimerTickData ;
+    Timer1Control = 3 ;             // enable interrupts and start counting
+    SetInterruptMask(2) ;           // allow level 3 and above
+}
+
+void StartTickTimer(void)
+{
+    if(TickPeriodns == 0)
+        CalibrateTickTimer() ;
+    RunTickTimer() ;
+}
+
+// stop the tick and return the elapsed time in ticks
+
+unsigned int StopTickTimer(void)
+{
+    SetInterruptMask(7) ;
+    Timer1Control = 0 ;
+    InstallExceptionHandler(UnhandledIRQ3, TimerIRQVector) ;
+    return TickCount ;
+}
+
+// send CalibrationChars NULs (which terminals ignore) as fast as the transmitter takes them,
+// returns the number of times round the wait loop
+
+unsigned int SendCalibrationChars(void)
+{
+    unsigned int i, Spins = 0 ;
+
+    for(i = 0; i < CalibrationChars; i ++) {
+        while(((char)(RS232_Status) & (char)(0x02)) != (char)(0x02))    // wait for Tx data register to empty
+            Spins ++ ;
+        RS232_TxData = 0 ;
+    }
+    return Spins ;
+}
+
+void CalibrateTickTimer(void)
+{
+    unsigned int Ticks, Windowns, SpinsOff, SpinsOn ;
+
+    printf("\r\nCalibrating Timer 1.....") ;
+    SendCalibrationChars() ;               // get the transmitter going so the window starts on a character boundary
+    SpinsOff = SendCalibrationChars() ;
+
+    RunTickTimer() ;
+    SpinsOn = SendCalibrationChars() ;
+    Ticks = StopTickTimer() ;
+
+    Windowns = MulDiv(CalibrationChars * 10, 1000000000, BaudCodeToRate(InteractiveBaudCode)) ;
+    if(Ticks == 0)
+        Ticks = 1 ;
+    TickPeriodns = Windowns / Ticks ;
+
+    if(SpinsOn > SpinsOff || SpinsOff == 0)
+        SpinsOn = SpinsOff ;
+    TickCPUns = MulDiv(TickPeriodns, SpinsOn, SpinsOff) ;
+
+    printf("\r\nTimer 1 tick = %d.%03d us, %d.%03d us of it left to the program", TickPeriodns / 1000, TickPeriodns % 1000,
+        TickCPUns / 1000, TickCPUns % 1000) ;
+}
+
+// elapsed time of a tick count in micro seconds
+
+unsigned int TicksTous(unsigned int Ticks)
+{
+    return MulDiv(Ticks, TickPeriodns, 1000) ;
+}
+
+// CPU time the program had in a tick count, the tick ISR's own time taken out
+
+unsigned int TicksToCPUus(unsigned int Ticks)
+{
+    return MulDiv(Ticks, TickCPUns, 1000) ;
+}
+
+/*******************************************************************************************
+** March memory tests
+**
+** A march test is a list of elements, each of which visits every long word in the range in
+** ascending (up) or descending (down) order and does the same reads and writes to it:
+**
+**  MATS+    : any(w0) up(r0,w1) down(r1,w0)
+**  March C- : any(w0) up(r0,w1) up(r1,w0) down(r0,w1) down(r1,w0) any(r0)
+**
+** '0' is the data background for the pass and '1' is its complement. Unlike writing and
+** immediately reading back each location, each cell is read again after its neighbours have
+** been written, so address decoder faults and coupling faults between cells show up.
+** The loops are unrolled 8 times and work in long words to keep the 68k loop overhead down.
+** The monitor's own variables and stacks are skipped automatically.
+*******************************************************************************************/
+
+#define MarchW      1               // element writes only
+#define MarchRW     2               // element reads then writes each long word
+#define MarchR      3               // element reads only
+
+void MarchFail(unsigned int *Address, unsigned int Expected, unsigned int Actual)
+{
+    if(MarchFailures < MarchMaxFailures)
+        printf("\r\nFAIL at Address [$%08X]: Expected [$%08X], Read [$%08X]", Address, Expected, Actual) ;
+    MarchFailures ++ ;
+}
+
+void MarchUp(unsigned int *p, unsigned int *end, int Op, unsigned int r, unsigned int w)
+{
+    unsigned int v ;            // value read back, passed on to MarchFail()
+
+    if(Op == MarchW) {
+        while(p + 8 <= end) {
+            p[0] = w ; p[1] = w ; p[2] = w ; p[3] = w ;
+            p[4] = w ; p[5] = w ; p[6] = w ; p[7] = w ;
+            p += 8 ;
+        }
+        while(p < end)
+            *p++ = w ;
+    }
+    else if(Op == MarchRW) {
+        while(p + 8 <= end) {
+            if((v = p[0]) != r) MarchFail(&p[0], r, v) ; p[0] = w ;
+            if((v = p[1]) != r) MarchFail(&p[1], r, v) ; p[1] = w ;
+            if((v = p[2]) != r) MarchFail(&p[2], r, v) ; p[2] = w ;
+            if((v = p[3]) != r) MarchFail(&p[3], r, v) ; p[3] = w ;
+            if((v = p[4]) != r) MarchFail(&p[4], r, v) ; p[4] = w ;
+            if((v = p[5]) != r) MarchFail(&p[5], r, v) ; p[5] = w ;
+            if((v = p[6]) != r) MarchFail(&p[6], r, v) ; p[6] = w ;
+            if((v = p[7]) != r) MarchFail(&p[7], r, v) ; p[7] = w ;
+            p += 8 ;
+        }
+        for( ; p < end; p ++) {
+            if((v = *p) != r) MarchFail(p, r, v) ;
+            *p = w ;
+        }
+    }
+    else {
+        while(p + 8 <= end) {
+            if((v = p[0]) != r) MarchFail(&p[0], r, v) ;
+            if((v = p[1]) != r) MarchFail(&p[1], r, v) ;
+            if((v = p[2]) != r) MarchFail(&p[2], r, v) ;
+            if((v = p[3]) != r) MarchFail(&p[3], r, v) ;
+            if((v = p[4]) != r) MarchFail(&p[4], r, v) ;
+            if((v = p[5]) != r) MarchFail(&p[5], r, v) ;
+            if((v = p[6]) != r) MarchFail(&p[6], r, v) ;
+            if((v = p[7]) != r) MarchFail(&p[7], r, v) ;
+            p += 8 ;
+        }
+        for( ; p < end; p ++)
+            if((v = *p) != r) MarchFail(p, r, v) ;
+    }
+}
+
+// same as MarchUp() but visits the long words from end-1 down to start
+
+void MarchDown(unsigned int *start, unsigned int *p, int Op, unsigned int r, unsigned int w)
+{
+    unsigned int v ;            // value read back, passed on to MarchFail()
+
+    if(Op == MarchRW) {
+        while(p >= start + 8) {
+            p -= 8 ;
+            if((v = p[7]) != r) MarchFail(&p[7], r, v) ; p[7] = w ;
+            if((v = p[6]) != r) MarchFail(&p[6], r, v) ; p[6] = w ;
+            if((v = p[5]) != r) MarchFail(&p[5], r, v) ; p[5] = w ;
+            if((v = p[4]) != r) MarchFail(&p[4], r, v) ; p[4] = w ;
+            if((v = p[3]) != r) MarchFail(&p[3], r, v) ; p[3] = w ;
+            if((v = p[2]) != r) MarchFail(&p[2], r, v) ; p[2] = w ;
+            if((v = p[1]) != r) MarchFail(&p[1], r, v) ; p[1] = w ;
+            if((v = p[0]) != r) MarchFail(&p[0], r, v) ; p[0] = w ;
+        }
+        while(p > start) {
+            p -- ;
+            if((v = *p) != r) MarchFail(p, r, v) ;
+            *p = w ;
+        }
+    }
+    else        // only read/write elements are ever run downwards
+        printf("\r\nMarchDown: unsupported element") ;
+}
+
+// run one march element over every segment of the range in the right order
+
+void MarchElement(unsigned int *SegStart, unsigned int *SegEnd, int NumSegs, int Down, int Op, unsigned int r, unsigned int w, int Quiet, char *Name)
+{
+    int i ;
+
+    if(!Quiet)
+        printf("\r\n    %s", Name) ;
+
+    if(Down) {
+        for(i = NumSegs - 1; i >= 0; i --)
+            MarchDown((unsigned int *)(SegStart[i]), (unsigned int *)(SegEnd[i]), Op, r, w) ;
+    }
+    else {
+        for(i = 0; i < NumSegs; i ++)
+            MarchUp((unsigned int *)(SegStart[i]), (unsigned int *)(SegEnd[i]), Op, r, w) ;
+    }
+}
+
+// cut [Start, End) into up to 3 segments that avoid the monitor data and stack areas
+
+int MarchSegments(unsigned int Start, unsigned int End, unsigned int *SegStart, unsigned int *SegEnd)
+{
+    unsigned int HoleStart[2], HoleEnd[2] ;
+    int i, n = 0 ;
+
+    HoleStart[0] = MonitorDataStart ;   HoleEnd[0] = MonitorDataEnd + 1 ;
+    HoleStart[1] = MonitorStackStart ;  HoleEnd[1] = MonitorStackEnd + 1 ;
+
+    for(i = 0; i < 2 && Start < End; i ++) {
+        if(End <= HoleStart[i] || Start >= HoleEnd[i])
+            continue ;
+
+        if(Start < HoleStart[i]) {
+            SegStart[n] = Start ;
+            SegEnd[n++] = HoleStart[i] ;
+        }
+        printf("\r\nSkipping Monitor Area [$%08X - $%08X]", HoleStart[i], HoleEnd[i] - 1) ;
+        Start = HoleEnd[i] ;
+    }
+
+    if(Start < End) {
+        SegStart[n] = Start ;
+        SegEnd[n++] = End ;
+    }
+    return n ;
+}
+
+void MarchTest(int MarchType)
+{
+    unsigned int Start, End, Bytes, Ticks, KBytes, KBps, r0, r1 ;
+    unsigned int SegStart[3], SegEnd[3] ;
+    int NumSegs, NumPasses, Pass, Quiet, Accesses ;
+    char c ;
+    char *Name ;
+
+    if(MarchType == 'c') {
+        Name = "March C-" ;
+        Accesses = 10 ;                     // reads+writes per long word
+    }
+    else {
+        Name = "MATS+" ;
+        Accesses = 5 ;
+    }
+
+    printf("\r\n%s Memory Test [$%08X - $%08X]", Name, DramStart, DramEnd) ;
+    printf("\r\nEnter Start Address: ") ;
+    Start = Get8HexDigits(0) & ~3 ;
+    printf("\r\nEnter End Address: ") ;
+    End = (Get8HexDigits(0) + 1) & ~3 ;     // end address is inclusive
+
+    if(Start < DramStart || End - 1 > DramEnd || Start >= End) {
+        printf("\r\nInvalid address range: must be in $%08X to $%08X", DramStart, DramEnd) ;
+        return ;
+    }
+
+    printf("\r\nNumber of Passes (1-9): ") ;
+    NumPasses = xtod(_getch()) ;
+    if(NumPasses < 1 || NumPasses > 9)
+        NumPasses = 1 ;
+
+    printf("\r\nQuiet Mode (Y/N): ") ;
+    c = toupper(_getch()) ;
+    Quiet = (c == (char)('Y')) ;
+
+    NumSegs = MarchSegments(Start, End, SegStart, SegEnd) ;
+    for(Bytes = 0, Pass = 0; Pass < NumSegs; Pass ++)
+        Bytes += SegEnd[Pass] - SegStart[Pass] ;
+
+    MarchFailures = 0 ;
+
+    for(Pass = 0; Pass < NumPasses; Pass ++) {
+
+        // change the data background every pass so each bit is tested both ways against its neighbours
+
+        if((Pass & 3) == 0)         r0 = 0x00000000 ;
+        else if((Pass & 3) == 1)    r0 = 0x55555555 ;
+        else if((Pass & 3) == 2)    r0 = 0x33333333 ;
+        else                        r0 = 0x0F0F0F0F ;
+        r1 = ~r0 ;
+
+        if(!Quiet)
+            printf("\r\nPass %d: Data Background [$%08X]", Pass + 1, r0) ;
+
+        StartTickTimer() ;
+        MarchElement(SegStart, SegEnd, NumSegs, 0, MarchW, 0, r0, Quiet, "any(w0)") ;
+        MarchElement(SegStart, SegEnd, NumSegs, 0, MarchRW, r0, r1, Quiet, "up(r0,w1)") ;
+        if(MarchType == 'c') {
+            MarchElement(SegStart, SegEnd, NumSegs, 0, MarchRW, r1, r0, Quiet, "up(r1,w0)") ;
+            MarchElement(SegStart, SegEnd, NumSegs, 1, MarchRW, r0, r1, Quiet, "down(r0,w1)") ;
+            MarchElement(SegStart, SegEnd, NumSegs, 1, MarchRW, r1, r0, Quiet, "down(r1,w0)") ;
+            MarchElement(SegStart, SegEnd, NumSegs, 0, MarchR, r0, 0, Quiet, "any(r0)") ;
+        }
+        else
+            MarchElement(SegStart, SegEnd, NumSegs, 1, MarchRW, r1, r0, Quiet, "down(r1,w0)") ;
+        Ticks = StopTickTimer() ;
+
+        // throughput in KBytes/sec of bus traffic, kept in 32 bits for a 64MB range
+
+        KBytes = (Bytes >> 10) * Accesses ;
+        Ticks = TicksTous(Ticks) / 100 ;        // now in 100us units
+        if(Ticks == 0)
+            Ticks = 1 ;
+        KBps = (KBytes / Ticks) * 10000 + ((KBytes % Ticks) * 10000) / Ticks ;
+
+        printf("\r\nPass %d: %d KBytes in %d.%04d sec = %d.%02d MBytes/sec, %d Failures",
+            Pass + 1, Bytes >> 10, Ticks / 10000, Ticks % 10000, KBps >> 10, ((KBps & 1023) * 100) >> 10, MarchFailures) ;
+    }
+
+    if(MarchFailures == 0)
+        printf("\r\n%s Test Passed", Name) ;
+    else
+        printf("\r\n%s Test Failed: %d Failures (first %d shown)", Name, MarchFailures, MarchMaxFailures) ;
+}
+
+/*******************************************************************************************
+** Hardware memory test using the BIST engine beside the Dram controller
+** The BIST drives the controller directly, so it runs at controller speed rather than at
+** 68k bus speed. The range is split around the monitor areas just like the march tests.
+** The end of each run is signalled by the BIST's level 6 interrupt
+*******************************************************************************************/
+
+void BistISR(void)
+{
+    BistControl = BIST_CLEARDONE ;          // clears done, and with it the interrupt
+    BistFinished = 1 ;
+}
+
+void HardwareMemoryTest(void)
+{
+    unsigned int Start, End, Bytes, Ticks, Total, Address, KBps, Deadline ;
+    unsigned int SegStart[3], SegEnd[3] ;
+    int i, n, NumSegs, Pattern, Status, Failures ;
+    char *PatternName[3] ;
+
+    PatternName[0] = "Address in Data" ;
+    PatternName[1] = "Checkerboard" ;
+    PatternName[2] = "Walking Ones" ;
+
+    printf("\r\nHardware Memory Test [$%08X - $%08X]", DramStart, DramEnd) ;
+    printf("\r\nEnter Start Address: ") ;
+    Start = Get8HexDigits(0) & ~1 ;
+    printf("\r\nEnter End Address: ") ;
+    End = (Get8HexDigits(0) + 1) & ~1 ;
+
+    if(Start < DramStart || End - 1 > DramEnd || Start >= End) {
+        printf("\r\nInvalid address range: must be in $%08X to $%08X", DramStart, DramEnd) ;
+        return ;
+    }
+
+    printf("\r\nSelect Pattern [0 = Address in Data, 1 = Checkerboard, 2 = Walking Ones]: ") ;
+    Pattern = xtod(_getch()) ;
+    if(Pattern < 0 || Pattern > 2)
+        Pattern = 0 ;
+
+    if(BistStatus & BIST_BUSY) {
+        printf("\r\nBIST Engine is busy") ;
+        return ;
+    }
+
+    NumSegs = MarchSegments(Start, End, SegStart, SegEnd) ;
+    Failures = Total = 0 ;
+    InstallExceptionHandler(BistISR, BistIRQVector) ;
+    StartTickTimer() ;                      // lowers the interrupt mask to 2, so level 6 gets through too
+
+    for(n = 0; n < NumSegs; n ++) {
+        BistControl = BIST_CLEARDONE ;
+        BistStartHi = SegStart[n] >> 16 ;
+        BistStartLo = SegStart[n] ;
+        BistEndHi = (SegEnd[n] - 2) >> 16 ;         // BIST end address is inclusive
+        BistEndLo = (SegEnd[n] - 2) ;
+        BistFinished = 0 ;
+        BistControl = (Pattern << 2) | BIST_IRQEN | BIST_START ;
+
+        // don't hang if the BIST never finishes (not in the hardware, or the controller stuck)
+
+        Deadline = TickCount + MulDiv(SegEnd[n] - SegStart[n], BistTimeoutnsPerByte, TickPeriodns) + 1000000000 / TickPeriodns ;
+        while(BistFinished == 0) {
+            if(TickCount > Deadline) {
+                StopTickTimer() ;
+                InstallExceptionHandler(UnhandledIRQ6, BistIRQVector) ;
+                Status = BistStatus ;
+                printf("\r\nBIST Engine timed out: Status [$%04X], testing [$%08X - $%08X]", Status & 0xFFFF, SegStart[n], SegEnd[n] - 1) ;
+                printf("\r\nHardware Memory Test Failed") ;
+                return ;
+            }
+        }
+
+        if(BistFailCount != 0) {
+            for(i = 0; i < BistNumFailEntries && i < BistFailCount; i ++) {
+                Address = ((unsigned int)(BistFailAddrHi(i)) << 16) | BistFailAddrLo(i) ;
+                printf("\r\nFAIL at Address [$%08X]: Expected [$%04X], Read [$%04X], Syndrome [$%04X]",
+                    Address, BistFailExpected(i), BistFailExpected(i) ^ BistFailSyndrome(i), BistFailSyndrome(i)) ;
+            }
+            Failures += BistFailCount ;
+        }
+        Total += SegEnd[n] - SegStart[n] ;
+    }
+    Ticks = StopTickTimer() ;
+    InstallExceptionHandler(UnhandledIRQ6, BistIRQVector) ;
+
+    // 6 word accesses per address for the 4 element march
+
+    Bytes = (Total >> 10) * 6 ;
+    Ticks = TicksTous(Ticks) / 100 ;
+    if(Ticks == 0)
+        Ticks = 1 ;
+    KBps = (Bytes / Ticks) * 10000 + ((Bytes % Ticks) * 10000) / Ticks ;
+
+    printf("\r\n%s: %d KBytes in %d.%04d sec = %d.%02d MBytes/sec", PatternName[Pattern],
+        Total >> 10, Ticks / 10000, Ticks % 10000, KBps >> 10, ((KBps & 1023) * 100) >> 10) ;
+
+    if(Failures == 0)
+        printf("\r\nHardware Memory Test Passed") ;
+    else
+        printf("\r\nHardware Memory Test Failed: %d Failures (first %d per segment shown)", Failures, BistNumFailEntries) ;
+}
+
+/*******************************************************************************************
+** Memory bandwidth and latency benchmark ('TB' command)
+**
+** Each test is repeated until it has run for at least BenchMinTime so small, cache
+** sized buffers get timed as accurately as large ones. Results are in decimal MBytes/sec
+** (bytes per micro second) and nano seconds per 32 bit access, worked out from the time the
+** loops had to themselves (TicksToCPUus), so the Timer 1 ISR's share doesn't show in them
+*******************************************************************************************/
+
+// a * b / c without overflowing 32 bits in the middle, used to scale tick counts
+
+unsigned int MulDiv(unsigned int a, unsigned int b, unsigned int c)
+{
+    unsigned int hi, lo, mid1, mid2, rem, q ;
+    int i ;
+
+    if(c == 0)
+        return 0 ;
+
+    // 64 bit product hi:lo from 16 bit halves
+
+    lo = (a & 0xFFFF) * (b & 0xFFFF) ;
+    mid1 = (a >> 16) * (b & 0xFFFF) ;
+    mid2 = (a & 0xFFFF) * (b >> 16) ;
+    hi = (a >> 16) * (b >> 16) + (mid1 >> 16) + (mid2 >> 16) ;
+
+    mid1 <<= 16 ;
+    if(lo + mid1 < lo) hi ++ ;
+    lo += mid1 ;
+    mid2 <<= 16 ;
+    if(lo + mid2 < lo) hi ++ ;
+    lo += mid2 ;
+
+    // then long divide by c one bit at a time
+
+    rem = q = 0 ;
+    for(i = 63; i >= 0; i --) {
+        if(rem & 0x80000000) {                          // remainder about to overflow so c must go into it
+            rem = (rem << 1) | ((i >= 32 ? hi >> (i - 32) : lo >> i) & 1) ;
+            rem -= c ;
+            q = (q << 1) | 1 ;
+        }
+        else {
+            rem = (rem << 1) | ((i >= 32 ? hi >> (i - 32) : lo >> i) & 1) ;
+            if(rem >= c) {
+                rem -= c ;
+                q = (q << 1) | 1 ;
+            }
+            else
+                q <<= 1 ;
+        }
+    }
+    return q ;
+}
+
+void BenchWrite(unsigned int *p, unsigned int n)
+{
+    unsigned int *end = p + n ;
+
+    while(p < end) {
+        p[0] = 0 ; p[1] = 0 ; p[2] = 0 ; p[3] = 0 ;
+        p[4] = 0 ; p[5] = 0 ; p[6] = 0 ; p[7] = 0 ;
+        p += 8 ;
+    }
+}
+
+unsigned int BenchRead(unsigned int *p, unsigned int n)
+{
+    unsigned int *end = p + n ;
+    unsigned int sum = 0 ;
+
+    while(p < end) {
+        sum += p[0] ; sum += p[1] ; sum += p[2] ; sum += p[3] ;
+        sum += p[4] ; sum += p[5] ; sum += p[6] ; sum += p[7] ;
+        p += 8 ;
+    }
+    return sum ;
+}
+
+// read every long word of the buffer, but Stride long words apart
+
+unsigned int BenchStrideRead(unsigned int *base, unsigned int n, unsigned int Stride)
+{
+    unsigned int *p, *end = base + n ;
+    unsigned int sum = 0, offset ;
+
+    for(offset = 0; offset < Stride; offset ++)
+        for(p = base + offset; p < end; p += Stride)
+            sum += *p ;
+    return sum ;
+}
+
+// each load gives the address of the next so no two accesses can overlap
+
+unsigned int *BenchChase(unsigned int *p, unsigned int n)
+{
+    while(n >= 8) {
+        p = (unsigned int *)(*p) ; p = (unsigned int *)(*p) ;
+        p = (unsigned int *)(*p) ; p = (unsigned int *)(*p) ;
+        p = (unsigned int *)(*p) ; p = (unsigned int *)(*p) ;
+        p = (unsigned int *)(*p) ; p = (unsigned int *)(*p) ;
+        n -= 8 ;
+    }
+    return p ;
+}
+
+void BenchReport(char *Name, unsigned int Accesses, unsigned int Ticks)
+{
+    unsigned int us, MBps, ns ;
+
+    us = TicksToCPUus(Ticks) ;                  // the benchmark loop's own time, not the tick ISR's
+    if(us == 0)
+        us = 1 ;
+
+    MBps = MulDiv(Accesses, 400, us) ;          // 4 bytes per access, 2 decimal places
+    ns = MulDiv(us, 10000, Accesses) ;          // 1 decimal place
+
+    printf("\r\n  %-20s %6d.%02d MBytes/sec %6d.%01d ns/access", Name, MBps / 100, MBps % 100, ns / 10, ns % 10) ;
+}
+
+void MemoryBenchmark(void)
+{
+    unsigned int Size, Stride, n, Slots, Step, Accesses, Ticks, MinTicks, i, Sum ;
+    unsigned int *Buffer = (unsigned int *)(BenchBuffer) ;
+    unsigned int *p ;
+    char c ;
+
+    printf("\r\nMemory Benchmark") ;
+    printf("\r\nBypass the Cache using the Uncached Dram Alias (Y/N): ") ;
+    c = toupper(_getch()) ;
+    if(c == (char)('Y'))
+        Buffer = (unsigned int *)(BenchBuffer + DramUncachedOffset) ;
+
+    printf("\r\nBuffer at [$%08X]", Buffer) ;
+    printf("\r\nEnter Test Size in KBytes (hex, max %04X): ", BenchMaxSize >> 10) ;
+    Size = Get4HexDigits(0) << 10 ;
+    printf("\r\nEnter Stride in Bytes (hex, multiple of 4): ") ;
+    Stride = Get4HexDigits(0) & ~3 ;
+
+    // power of 2 sizes keep the chase below a single full cycle
+
+    for(n = 1024; n * 2 <= Size && n * 2 <= BenchMaxSize; n *= 2)
+        ;
+    Size = n ;
+    if(Stride < 4 || Stride >= Size)
+        Stride = 4 ;
+
+    printf("\r\nSize = %d KBytes, Stride = %d Bytes, each test runs for at least %d ms", Size >> 10, Stride, BenchMinTime / 1000) ;
+
+    n = Size >> 2 ;                                     // long words in buffer
+    Sum = 0 ;
+
+    if(TickPeriodns == 0)
+        CalibrateTickTimer() ;
+    MinTicks = MulDiv(BenchMinTime, 1000, TickPeriodns) + 1 ;
+
+    StartTickTimer() ;
+    for(Accesses = 0; Accesses == 0 || TickCount < MinTicks; Accesses += n)
+        BenchWrite(Buffer, n) ;
+    Ticks = StopTickTimer() ;
+    BenchReport("Sequential Write", Accesses, Ticks) ;
+
+    StartTickTimer() ;
+    for(Accesses = 0; Accesses == 0 || TickCount < MinTicks; Accesses += n)
+        Sum += BenchRead(Buffer, n) ;
+    Ticks = StopTickTimer() ;
+    BenchReport("Sequential Read", Accesses, Ticks) ;
+
+    StartTickTimer() ;
+    for(Accesses = 0; Accesses == 0 || TickCount < MinTicks; Accesses += n)
+        Sum += BenchStrideRead(Buffer, n, Stride >> 2) ;
+    Ticks = StopTickTimer() ;
+    BenchReport("Strided Read", Accesses, Ticks) ;
+
+    // pointer chain through one long word per Stride, visited in a scattered order:
+    // slot i points to slot (i + Step) mod Slots, Step is odd and Slots a power of 2 so every slot is visited
+
+    for(Slots = 1; Slots * 2 <= Size / Stride; Slots *= 2)
+        ;
+    Step = ((Slots * 5) / 8) | 1 ;
+    for(i = 0; i < Slots; i ++)
+        *(unsigned int *)((char *)(Buffer) + i * Stride) = (unsigned int)((char *)(Buffer) + ((i + Step) & (Slots - 1)) * Stride) ;
+
+    p = Buffer ;
+    StartTickTimer() ;
+    for(Accesses = 0; Accesses == 0 || TickCount < MinTicks; Accesses += 1024)
+        p = BenchChase(p, 1024) ;
+    Ticks = StopTickTimer() ;
+    BenchReport("Pointer Chase", Accesses, Ticks) ;
+
+    if(Sum == 0x12345678 && p == 0)                     // use the results so the loops can't be removed
+        printf(" ") ;
+}
+
+/*******************************************************************************************
+** Dram controller performance counters ('TP' and 'TC' commands)
+**
+** 'TP' clears and starts the counters then runs the user program like 'G'. When the program
+** comes back to the debugger (TRAP #15 or a breakpoint) the counters are stopped and shown
+*******************************************************************************************/
+
+unsigned int DramCounter(int n)
+{
+    return ((unsigned int)(DramPerfCounterHi(n)) << 16) | DramPerfCounterLo(n) ;
+}
+
+void DramCountersShow(void)
+{
+    unsigned int Cycles, Reads, Writes, Activates, Hits, Conflicts, Refresh, Waits, Accesses, x ;
+
+    Cycles = DramCounter(PERF_CYCLES) ;
+    Reads = DramCounter(PERF_READS) ;
+    Writes = DramCounter(PERF_WRITES) ;
+    Activates = DramCounter(PERF_ACTIVATES) ;
+    Hits = DramCounter(PERF_ROWHITS) ;
+    Conflicts = DramCounter(PERF_ROWCONFLICTS) ;
+    Refresh = DramCounter(PERF_REFRESHSTALLS) ;
+    Waits = DramCounter(PERF_DTACKWAITS) ;
+    Accesses = Reads + Writes ;
+
+    printf("\r\nDram Performance Counters") ;
+    printf("\r\n  Clock Cycles          %10u", Cycles) ;
+    printf("\r\n  CPU Reads             %10u", Reads) ;
+    printf("\r\n  CPU Writes            %10u", Writes) ;
+    printf("\r\n  Bank Activates        %10u", Activates) ;
+    printf("\r\n  Row Hits              %10u", Hits) ;
+    printf("\r\n  Row Conflicts         %10u", Conflicts) ;
+    printf("\r\n  Refresh Stall Cycles  %10u", Refresh) ;
+    printf("\r\n  Dtack Wait Cycles     %10u", Waits) ;
+
+    // percentages and averages to 1 decimal place
+
+    x = MulDiv(Hits, 1000, Hits + Activates) ;
+    printf("\r\n  Row Hit Rate          %8d.%01d %%", x / 10, x % 10) ;
+    x = MulDiv(Waits, 10, Accesses) ;
+    printf("\r\n  Wait Cycles/Access    %8d.%01d", x / 10, x % 10) ;
+    x = MulDiv(Waits, 1000, Cycles) ;
+    printf("\r\n  Time Waiting for Dram %8d.%01d %%", x / 10, x % 10) ;
+}
+
+void DramCountersGo(void)
+{
+    printf("\r\nProgram Running with Dram Performance Counters.....") ;
+    printf("\r\nCounters are shown when the program ends with TRAP #15 or hits a breakpoint") ;
+    printf("\r\nPress <RESET> button <Key0> on DE1 to stop") ;
+    DramProfiling = 1 ;
+    GoFlag = 1 ;
+    DramPerfControl = PERF_CLEAR | PERF_ENABLE ;
+    go() ;
+}
+
+void DramCountersStopped(void)
+{
+    if(DramProfiling == 0)
+        return ;
+
+    DramPerfControl = 0 ;                   // stop counting the debugger's own accesses
+    DramProfiling = 0 ;
+    DramCountersShow() ;
+}
+
+void DramCountersDisplay(void)
+{
+    unsigned short int Running ;
+    char c ;
+
+    Running = DramPerfControl & PERF_ENABLE ;
+    DramPerfControl = 0 ;                   // stop while reading so each 32 bit count is consistent
+    DramCountersShow() ;
+
+    printf("\r\nClear Counters (Y/N): ") ;
+    c = toupper(_getch()) ;
+    DramPerfControl = ((c == (char)('Y')) ? PERF_CLEAR : 0) | Running ;
+}
+
+// a rising edge on FlushCache_H starts the flush, FlushBusy_H stays high until every dirty line
+// has been written back and the cache invalidated. On a board without the flush hardware
+// InPortC reads 0 so this returns straight away
+
+void FlushCache(void)
+{
+    int i ;
+
+    printf("\r\nFlushing Cache.....") ;
+    CacheFlushPort = 0 ;
+    CacheFlushPort = CACHE_FLUSH ;
+    CacheFlushPort = 0 ;
+
+    for(i = 0; i < CacheFlushTimeoutms; i ++) {
+        if((CacheFlushPort & CACHE_FLUSH) == 0) {
+            printf("Done") ;
+            return ;
+        }
+        Wait1ms() ;
+    }
+    printf("\r\nCache Flush timed out: FlushBusy_H still high after %dms", CacheFlushTimeoutms) ;
+}
+
+// the 16 bit counters are read a byte at a time, high byte first. They keep counting, so the
+// high byte is read again and the low byte retried if it changed underneath us
+
+unsigned int PrefetchCounter(int Select)
+{
+    unsigned char Hi, Lo ;
+
+    do  {
+        PrefetchCounterPort = Select + 1 ;
+        Hi = PrefetchCounterPort ;
+        PrefetchCounterPort = Select ;
+        Lo = PrefetchCounterPort ;
+        PrefetchCounterPort = Select + 1 ;
+    } while(PrefetchCounterPort != Hi) ;
+
+    return ((unsigned int)(Hi) << 8) | Lo ;
+}
+
+void PrefetchCountersDisplay(void)
+{
+    unsigned int Count, Hits, x ;
+
+    Count = PrefetchCounter(PREFETCH_COUNT) ;
+    Hits = PrefetchCounter(PREFETCH_HITS) ;
+
+    printf("\r\nCache Prefetch Counters (16 bit, wrap around)") ;
+    printf("\r\n  Lines Prefetched      %10u", Count) ;
+    printf("\r\n  Prefetched Lines Used %10u", Hits) ;
+
+    x = MulDiv(Hits, 1000, Count) ;
+    printf("\r\n  Prefetch Accuracy     %8d.%01d %%", x / 10, x % 10) ;
+}
+
 void MemoryTest(void)
 {
     unsigned int Start, End, addr;
@@ -1623,6 +2862,19 @@ void MemoryTest(void)
     unsigned int width_option = 0, i = 0, j = 0, value_from_mem = 0;
 
     // GET USER INPUTS
+    printf("\r\nSelect test [s = write/read back, c = March C-, m = MATS+, h = hardware BIST]: ");
+    c = tolower(_getch());
+    if (c == 'c' || c == 'm') {
+        MarchTest(c);
+        return;
+    } else if (c == 'h') {
+        HardwareMemoryTest();
+        return;
+    } else if (c != 's') {
+        printf("\r\nInvalid test selected");
+        return;
+    }
+
     scanflush();
     printf("\r\nSelect value width for test [b = bytes, w = words, l = long words]: ");
     if ((c = getchar()) != 0x1b) {
@@ -1696,10 +2948,147 @@ void MemoryTest(void)
     printf("\r\nTest passed\n");
 }
 
+/*******************************************************************************************
+** Power on self test, run before the monitor starts or boots from flash
+**
+** Quick enough to run every reset (a few thousand accesses, well under 100ms) and it
+** puts back everything it changes so a program already loaded in Dram survives a reset.
+**  1. walking ones on the 32 bit data bus, 32 long words in each bank
+**  2. address lines A2-A25: a different value at Dram + each power of 2, then check them all
+**     so any shorted or stuck address line shows up as two locations sharing data
+**  3. a sparse long word test every PostStride bytes across all 64MB
+** Every access goes through the uncached window and each test writes all of its locations
+** before reading any back, so neither the cache nor the controller's write queue can hand
+** back the value just written without it having been through the Dram.
+** The monitor's variable and stack areas are skipped.
+** Returns a bit mask of the 16MB banks (Address[25:24]) that failed, 0 if all passed
+*******************************************************************************************/
+
+int PostInMonitorArea(unsigned int Address)
+{
+    return (Address >= MonitorDataStart && Address <= MonitorDataEnd) || (Address >= MonitorStackStart && Address <= MonitorStackEnd) ;
+}
+
+int PostFail(char *Test, unsigned int Address, unsigned int Expected, unsigned int Actual)
+{
+    printf("\r\nPOST %s Failed at Address [$%08X]: Expected [$%08X], Read [$%08X]", Test, Address, Expected, Actual) ;
+    return 1 << ((Address >> 24) & 3) ;
+}
+
+// the uncached alias of a Dram address
+
+volatile unsigned int *PostUncached(unsigned int Address)
+{
+    return (volatile unsigned int *)(Address + DramUncachedOffset) ;
+}
+
+int PowerOnSelfTest(void)
+{
+    volatile unsigned int *p ;
+    unsigned int Address, Saved[PostNumAddressLines + 1], DataSaved[32], Value ;
+    int i, Bank, BadBanks = 0 ;
+
+    printf("\r\nPower On Self Test.....") ;
+
+    // data bus, 32 long words at the start of a 1MB block in each bank that is clear of the monitor
+
+    for(Bank = 0; Bank < 4; Bank ++) {
+        Address = DramStart + (Bank << 24) + 0x00100000 ;
+        p = PostUncached(Address) ;
+        for(i = 0; i < 32; i ++)
+            DataSaved[i] = p[i] ;
+        for(i = 0; i < 32; i ++)
+            p[i] = 1 << i ;
+        for(i = 0; i < 32; i ++) {
+            if((Value = p[i]) != (1 << i)) {
+                BadBanks |= PostFail("Data Bus", Address + (i << 2), 1 << i, Value) ;
+                break ;
+            }
+        }
+        for(i = 0; i < 32; i ++)
+            p[i] = DataSaved[i] ;
+    }
+
+    // address lines, Saved[0] is Dram base, Saved[i] is Dram base + (2 << i)
+
+    p = PostUncached(DramStart) ;
+    Saved[0] = p[0] ;
+    for(i = 1; i <= PostNumAddressLines; i ++)
+        Saved[i] = p[1 << (i - 1)] ;
+
+    p[0] = 0xA5A5A500 ;
+    for(i = 1; i <= PostNumAddressLines; i ++)
+        p[1 << (i - 1)] = 0xA5A5A500 | i ;
+
+    if((Value = p[0]) != 0xA5A5A500)
+        BadBanks |= PostFail("Address Line", DramStart, 0xA5A5A500, Value) ;
+    for(i = 1; i <= PostNumAddressLines; i ++)
+        if((Value = p[1 << (i - 1)]) != (0xA5A5A500 | i))
+            BadBanks |= PostFail("Address Line", DramStart + (4 << (i - 1)), 0xA5A5A500 | i, Value) ;
+
+    for(i = PostNumAddressLines; i >= 1; i --)                  // restore in reverse in case two lines are shorted
+        p[1 << (i - 1)] = Saved[i] ;
+    p[0] = Saved[0] ;
+
+    // sparse pattern and its complement across the whole of Dram, a whole pass of writes then a pass of reads
+
+    for(Address = DramStart, i = 0; Address < DramEnd; Address += PostStride, i ++)
+        if(!PostInMonitorArea(Address))
+            PostSaved[i] = *PostUncached(Address) ;
+
+    for(Address = DramStart; Address < DramEnd; Address += PostStride)
+        if(!PostInMonitorArea(Address))
+            *PostUncached(Address) = Address ;
+    for(Address = DramStart; Address < DramEnd; Address += PostStride)
+        if(!PostInMonitorArea(Address) && (Value = *PostUncached(Address)) != Address)
+            BadBanks |= PostFail("Pattern", Address, Address, Value) ;
+
+    for(Address = DramStart; Address < DramEnd; Address += PostStride)
+        if(!PostInMonitorArea(Address))
+            *PostUncached(Address) = ~Address ;
+    for(Address = DramStart; Address < DramEnd; Address += PostStride)
+        if(!PostInMonitorArea(Address) && (Value = *PostUncached(Address)) != ~Address)
+            BadBanks |= PostFail("Pattern", Address, ~Address, Value) ;
+
+    for(Address = DramStart, i = 0; Address < DramEnd; Address += PostStride, i ++)
+        if(!PostInMonitorArea(Address))
+            *PostUncached(Address) = PostSaved[i] ;
+
+    if(BadBanks == 0)
+        printf("Passed") ;
+    else {
+        printf("\r\nPOST Failed: Bad Dram Banks [") ;
+        for(Bank = 0; Bank < 4; Bank ++)
+            if(BadBanks & (1 << Bank))
+                printf(" %d", Bank) ;
+        printf(" ]") ;
+        PostLCDMessage(BadBanks) ;
+    }
+    return BadBanks ;
+}
+
+// show the failed banks on the 2nd line of the LCD e.g. "POST FAIL: 0 2"
+
+void PostLCDMessage(int BadBanks)
+{
+    char Message[20] ;
+    int Bank, n ;
+
+    strcpy(Message, "POST FAIL:") ;
+    n = strlen(Message) ;
+    for(Bank = 0; Bank < 4; Bank ++)
+        if(BadBanks & (1 << Bank)) {
+            Message[n++] = ' ' ;
+            Message[n++] = '0' + Bank ;
+        }
+    Message[n] = 0 ;
+    Oline1(Message) ;
+}
+
 void main(void)
 {
     char c ;
-    int i, j ;
+    int i, j, PostBadBanks ;
 
     char *AlyssaInfo = "Name: Alyssa da Costa, Student Number: 13316294";
     char *AswinInfo = "Name: Aswin Sai Subramanian, Student Number: 49513567";
@@ -1711,6 +3100,10 @@ void main(void)
     i = x = y = z = PortA_Count = 0;
     Trace = GoFlag = 0;                       // used in tracing/single stepping
     Echo = 1 ;
+    RxHead = RxTail = 0 ;
+    RxPolling = RxOverrun = 0 ;
+    DownloadBaudCode = InteractiveBaudCode ;
+    DramProfiling = 0 ;
 
     d0=d1=d2=d3=d4=d5=d6=d7=0 ;
     a0=a1=a2=a3=a4=a5=a6=0 ;
@@ -1732,6 +3125,7 @@ void main(void)
     Init_RS232() ;     // initialise the RS232 port
     Init_LCD() ;
     SPI_Init();
+    LoadDownloadBaudRate() ;                    // download baud rate saved by the 'N' command
 
     for( i = 32; i < 48; i++)
        InstallExceptionHandler(UnhandledTrap, i) ;		        // install Trap exception handler on vector 32-47
@@ -1764,9 +3158,15 @@ void main(void)
     TraceException = 0 ;                     // clear trace exception port to remove any software generated single step/trace
 
 
+    PostBadBanks = PowerOnSelfTest() ;       // check the Dram before anything is copied into it
+
     // test for auto flash boot and run from Flash by reading switch 9 on DE1-soc board. If set, copy program from flash into Dram and run
+    // the program is copied into bank 0 so don't boot if that bank failed the POST
 
-    while(((char)(PortB & 0x02)) == (char)(0x02))    {
+    if(((char)(PortB & 0x02)) == (char)(0x02) && (PostBadBanks & 0x01)) {
+        printf("\r\nFlash Boot Refused: Dram Bank 0 failed the Power On Self Test") ;
+    }
+    else while(((char)(PortB & 0x02)) == (char)(0x02))    {
         LoadFromFlashChip();
         printf("\r\nRunning.....") ;
         Oline1("Running.....") ;
@@ -1778,6 +3178,8 @@ void main(void)
 
     Oline0(BugMessage) ;
     Oline1("By: PJ Davies") ;
+    if(PostBadBanks)
+        PostLCDMessage(PostBadBanks) ;
 
     printf("\r\n%s", BugMessage) ;
     printf("\r\n%s\n", CopyrightMessage) ;
@@ -466,6 +466,20 @@ _go
                 rte                    load the status reg and PC from the stack and commence running
                                        *used to be rte but this didn't load the status byte
 
+***************************************************************************************************
+* SetInterruptMask(int Mask) function in debug monitor, sets the IRQ mask (bits 10-8) of the
+* status register so the monitor can enable the Timer 1 tick while timing a test
+***************************************************************************************************
+_SetInterruptMask
+                move.l   4(sp),d0       get the new mask 0-7 passed by the C code on the stack
+                andi.w   #7,d0
+                lsl.w    #8,d0          move it up to bits 10-8
+                move.w   sr,d1
+                andi.w   #$F8FF,d1      clear the old mask
+                or.w     d0,d1
+                move.w   d1,sr
+                rts
+
                 section const
 
                 section   data                  for initialised data
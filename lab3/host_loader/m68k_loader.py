@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+###############################################################################
+# Host loader for the 68k debug monitor (lab3/debug_monitor)
+#
+# A plain serial terminal that also speaks the monitor's baud rate protocol
+# (see NegotiateBaudRate() in M68kDebug_nd.c), so 'N' can find the fastest
+# rate the cable copes with and 'L'/'Q' downloads run at that rate.
+#
+#   python3 m68k_loader.py <port> [program.hex]
+#
+# Lines typed on the keyboard are sent to the monitor. A line of the form
+#   !send <file.hex>
+# sends a .hex (S record) file, e.g. after the monitor's 'L' or 'Q' prompt.
+# The file given on the command line is what a bare "!send" sends.
+# !quit (or Ctrl-C) ends the session.
+#
+# Needs pyserial (pip install pyserial)
+###############################################################################
+
+import sys
+import threading
+import time
+
+import serial
+
+InteractiveRate = 115200                # InteractiveBaudCode in DebugMonitor.h
+BaudCodeToRate = {0: 230400, 1: 115200, 2: 57600, 3: 38400, 4: 19200, 5: 9600}     # RS232_Baud codes
+TestLength = 3 * 64                     # NegotiateBlocks * NegotiateBlockSize in DebugMonitor.h
+SilenceTimeout = 0.5                    # seconds without a character before going back to the last good rate
+
+
+class Loader:
+    def __init__(self, PortName):
+        self.Port = serial.Serial(PortName, InteractiveRate, timeout=0.1)
+        self.Lock = threading.Lock()    # the reader thread owns the port while the baud rate is changing
+        self.Running = True
+
+    def Write(self, Data):
+        with self.Lock:
+            self.Port.write(Data)
+
+    # "~B<code>\r\n" or "~T<code>\r\n" from the monitor, reply at the old rate then switch
+
+    def ChangeRate(self, Kind, Code):
+        with self.Lock:
+            OldRate = self.Port.baudrate
+            self.Port.write(b'+')
+            self.Port.flush()
+            time.sleep(0.01)
+            self.Port.baudrate = BaudCodeToRate[Code]
+
+            if Kind != b'T':
+                return
+
+            # echo test, the monitor sends '+' after the last character if every echo matched
+            self.Port.timeout = SilenceTimeout
+            for i in range(TestLength):
+                c = self.Port.read(1)
+                if not c:
+                    break
+                self.Port.write(c)
+            else:
+                c = self.Port.read(1)
+                if c == b'+':
+                    self.Port.timeout = 0.1
+                    sys.stdout.write('\r\n[loader: %d baud ok]\r\n' % self.Port.baudrate)
+                    return
+
+            self.Port.baudrate = OldRate
+            self.Port.timeout = 0.1
+            sys.stdout.write('\r\n[loader: %d baud failed, back to %d]\r\n' % (BaudCodeToRate[Code], OldRate))
+
+    def Reader(self):
+        while self.Running:
+            c = self.Port.read(1)
+            if c != b'~':
+                sys.stdout.write(c.decode('ascii', 'replace'))
+                sys.stdout.flush()
+                continue
+
+            Command = self.Port.read(4)                 # B or T, code digit, \r\n
+            if len(Command) == 4 and Command[0:1] in (b'B', b'T') and Command[1:2].isdigit() and int(Command[1:2]) in BaudCodeToRate:
+                self.ChangeRate(Command[0:1], int(Command[1:2]))
+            else:
+                sys.stdout.write(('~' + Command.decode('ascii', 'replace')))
+
+    def SendFile(self, FileName):
+        try:
+            with open(FileName, 'rb') as f:
+                Lines = f.read().splitlines()
+        except OSError as e:
+            print('[loader: %s]' % e)
+            return
+
+        for Line in Lines:
+            self.Write(Line.strip() + b'\r\n')
+        print('[loader: sent %d records from %s]' % (len(Lines), FileName))
+
+
+def main():
+    if len(sys.argv) < 2:
+        print('usage: m68k_loader.py <port> [program.hex]')
+        return 1
+
+    DefaultFile = sys.argv[2] if len(sys.argv) > 2 else None
+    loader = Loader(sys.argv[1])
+    threading.Thread(target=loader.Reader, daemon=True).start()
+
+    try:
+        for Line in sys.stdin:
+            Line = Line.rstrip('\r\n')
+            if Line == '!quit':
+                break
+            elif Line.startswith('!send'):
+                FileName = Line[5:].strip() or DefaultFile
+                if FileName:
+                    loader.SendFile(FileName)
+                else:
+                    print('[loader: no file given]')
+            else:
+                loader.Write(Line.encode('ascii', 'replace') + b'\r')
+    except KeyboardInterrupt:
+        pass
+
+    loader.Running = False
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,208 @@
+---------------------------------------------------------------------------------------
+-- 4 port arbiter in front of CacheEnabledDramController
+--
+-- Each master (cache controller for the 68k, DMA, blitter, video etc) has its own 68k style
+-- bus: AS_L, DramSelect_L, UDS_L, LDS_L, WE_L, address and data, with bit n of the strobe
+-- vectors belonging to port n. The granted port's bus is passed through to the Dram
+-- controller and only that port gets Dtack and sees the SDRAM CAS/RAS (masters use them
+-- to find their burst data on SDram_DQ), the others wait with Dtack high.
+--
+-- The grant only changes between bus cycles (granted AS_L and controller Dtack both high).
+-- Priority at each change:
+--		1. a port that has been waiting StarvationLimit clocks (lowest port number first)
+--		2. the current owner, until it has run PortNBurst bus cycles. It keeps the grant for up
+--		   to GrantHoldClocks between its own cycles so a streaming master is not interrupted
+--		3. port 0 when Port0Priority = 1, so the 68k's cache fills wait at most for the rest of
+--		   another port's burst
+--		4. the other requesters, round robin (RoundRobin = 1) or lowest port number (RoundRobin = 0)
+--
+-- Ports that are not used should have AS_L and DramSelect_L tied high, their address and data
+-- inputs can be left unconnected. 32_line_cache_project/CachedDramController.bdf puts the cache
+-- controller on port 0 with ports 1-3 tied off this way
+---------------------------------------------------------------------------------------
+
+LIBRARY ieee;
+USE ieee.std_logic_1164.all;
+USE ieee.std_logic_unsigned.all;
+USE ieee.std_logic_arith.all;
+
+entity DramArbiter is
+	Generic (
+		Port0Priority			: integer := 1;							-- 1 = port 0 wins any arbitration it takes part in
+		RoundRobin				: integer := 1;							-- 1 = round robin between the other ports, 0 = fixed priority
+		Port0Burst				: integer := 1;							-- bus cycles each port can run back to back once granted
+		Port1Burst				: integer := 8;
+		Port2Burst				: integer := 8;
+		Port3Burst				: integer := 8;
+		StarvationLimit		: integer := 512;							-- clocks a port can wait before it goes ahead of everything
+		GrantHoldClocks		: integer := 4								-- clocks the owner keeps the grant between its own cycles
+	);
+	Port (
+		Clock	 					: in std_logic ;
+		Reset_L    				: in std_logic ;
+
+		-- from the masters, bit n of each vector is port n
+
+		AS_L						: in std_logic_vector(3 downto 0);
+		DramSelect_L			: in std_logic_vector(3 downto 0);
+		UDS_L						: in std_logic_vector(3 downto 0);
+		LDS_L						: in std_logic_vector(3 downto 0);
+		WE_L						: in std_logic_vector(3 downto 0);
+		Address0					: in std_logic_vector(31 downto 0);
+		Address1					: in std_logic_vector(31 downto 0) := (others => '0');
+		Address2					: in std_logic_vector(31 downto 0) := (others => '0');
+		Address3					: in std_logic_vector(31 downto 0) := (others => '0');
+		DataIn0					: in std_logic_vector(15 downto 0);
+		DataIn1					: in std_logic_vector(15 downto 0) := (others => '0');
+		DataIn2					: in std_logic_vector(15 downto 0) := (others => '0');
+		DataIn3					: in std_logic_vector(15 downto 0) := (others => '0');
+
+		-- back to the masters
+
+		Dtack_L					: out std_logic_vector(3 downto 0);		-- Dtack to the granted port only
+		CAS_Dram_L				: out std_logic_vector(3 downto 0);		-- SDRAM CAS/RAS to the granted port only
+		RAS_Dram_L				: out std_logic_vector(3 downto 0);
+
+		-- to/from the Dram controller
+
+		AS_DramController_L				: out std_logic;
+		DramSelect_DramController_L	: out std_logic;
+		UDS_DramController_L				: out std_logic;
+		LDS_DramController_L				: out std_logic;
+		WE_DramController_L				: out std_logic;
+		AddressBusOutToDramController	: out std_logic_vector(31 downto 0);
+		DataBusOutToDramController		: out std_logic_vector(15 downto 0);
+		DtackFromDram_L					: in std_logic;
+		SDram_CAS_L							: in std_logic;
+		SDram_RAS_L							: in std_logic;
+
+		Grant						: out std_logic_vector(1 downto 0)			-- port that owns the controller, for debugging
+	);
+end ;
+
+architecture bhvr of DramArbiter is
+	type IntegerArray is array (0 to 3) of integer ;
+	type WaitArray is array (0 to 3) of integer range 0 to StarvationLimit ;
+
+	constant PortBurst		: IntegerArray := (Port0Burst, Port1Burst, Port2Burst, Port3Burst) ;
+
+	Signal	Request_H		: std_logic_vector(3 downto 0) ;					-- port n is trying to run a bus cycle
+	Signal	Owner				: integer range 0 to 3 ;								-- port connected to the Dram controller
+	Signal	BurstUsed		: integer range 0 to 255 ;								-- bus cycles run by the owner since it was granted
+	Signal	HoldCount		: integer range 0 to 255 ;								-- clocks the owner has not been requesting
+	Signal	WaitCount		: WaitArray ;												-- clocks each port has been waiting
+	Signal	LastOwnerAS_L	: std_logic ;
+Begin
+	Request_H <= not (AS_L or DramSelect_L) ;
+
+---------------------------------------------------------------------------------------------------------------------
+-- pass the owner's bus through to the Dram controller, Dtack and CAS/RAS back to the owner only
+---------------------------------------------------------------------------------------------------------------------
+
+	AS_DramController_L				<= AS_L(Owner) ;
+	DramSelect_DramController_L	<= DramSelect_L(Owner) ;
+	UDS_DramController_L				<= UDS_L(Owner) ;
+	LDS_DramController_L				<= LDS_L(Owner) ;
+	WE_DramController_L				<= WE_L(Owner) ;
+
+	AddressBusOutToDramController	<= Address0 when Owner = 0 else
+												Address1 when Owner = 1 else
+												Address2 when Owner = 2 else
+												Address3 ;
+
+	DataBusOutToDramController		<= DataIn0 when Owner = 0 else
+												DataIn1 when Owner = 1 else
+												DataIn2 when Owner = 2 else
+												DataIn3 ;
+
+	Grant <= conv_std_logic_vector(Owner, 2) ;
+
+	process(Owner, DtackFromDram_L, SDram_CAS_L, SDram_RAS_L)
+	begin
+		Dtack_L 		<= "1111" ;
+		CAS_Dram_L	<= "1111" ;
+		RAS_Dram_L	<= "1111" ;
+
+		Dtack_L(Owner)		<= DtackFromDram_L ;
+		CAS_Dram_L(Owner)	<= SDram_CAS_L ;
+		RAS_Dram_L(Owner)	<= SDram_RAS_L ;
+	end process ;
+
+---------------------------------------------------------------------------------------------------------------------
+-- arbitration, the owner only changes between bus cycles
+---------------------------------------------------------------------------------------------------------------------
+
+	process(Clock, Reset_L)
+		variable Winner 	: integer range 0 to 3 ;
+		variable Found		: boolean ;
+		variable Candidate	: integer range 0 to 3 ;
+	begin
+		if(Reset_L = '0') then
+			Owner 			<= 0 ;
+			BurstUsed 		<= 0 ;
+			HoldCount		<= 0 ;
+			WaitCount 		<= (others => 0) ;
+			LastOwnerAS_L	<= '1' ;
+
+		elsif(rising_edge(Clock)) then
+			for n in 0 to 3 loop
+				if(Request_H(n) = '1' and n /= Owner) then
+					if(WaitCount(n) /= StarvationLimit) then
+						WaitCount(n) <= WaitCount(n) + 1 ;
+					end if ;
+				else
+					WaitCount(n) <= 0 ;
+				end if ;
+			end loop ;
+
+			LastOwnerAS_L <= AS_L(Owner) ;
+			if(AS_L(Owner) = '0' and LastOwnerAS_L = '1' and BurstUsed /= 255) then		-- owner started another bus cycle
+				BurstUsed <= BurstUsed + 1 ;
+			end if ;
+
+			if(AS_L(Owner) = '1' and DtackFromDram_L = '1') then					-- between bus cycles
+				Found := false ;
+				Winner := Owner ;
+
+				for n in 0 to 3 loop
+					if(Found = false and Request_H(n) = '1' and WaitCount(n) = StarvationLimit) then
+						Winner := n ;
+						Found := true ;
+					end if ;
+				end loop ;
+
+				if(Found = false and BurstUsed < PortBurst(Owner) and (Request_H(Owner) = '1' or HoldCount < GrantHoldClocks)) then
+					Found := true ;
+				end if ;
+
+				if(Found = false and Port0Priority = 1 and Request_H(0) = '1') then
+					Winner := 0 ;
+					Found := true ;
+				end if ;
+
+				for i in 1 to 4 loop
+					if(RoundRobin = 1) then
+						Candidate := (Owner + i) mod 4 ;
+					else
+						Candidate := i - 1 ;
+					end if ;
+
+					if(Found = false and Request_H(Candidate) = '1') then
+						Winner := Candidate ;
+						Found := true ;
+					end if ;
+				end loop ;
+
+				if(Winner /= Owner) then
+					Owner 		<= Winner ;
+					BurstUsed	<= 0 ;
+					HoldCount	<= 0 ;
+				elsif(Request_H(Owner) = '1') then
+					HoldCount	<= 0 ;
+				elsif(HoldCount /= 255) then
+					HoldCount	<= HoldCount + 1 ;
+				end if ;
+			end if ;
+		end if ;
+	end process ;
+END ;
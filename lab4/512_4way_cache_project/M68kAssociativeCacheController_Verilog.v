@@ -4,6 +4,31 @@
 // designed to work with TG68 (68000 based) cpu with 16 bit data bus and 32 bit address bus
 // separate upper and lowe data stobes for individual byte and also 16 bit word access
 //
+// CASLatency parameter must match the CAS latency programmed by the Dram controller
+//
+// A read hit is decided in Idle from the tag compare of the 68k's address, so Dtack goes out in the next clock
+// and the LRU bits are updated while the 68k finishes its cycle. A miss goes on to CheckForCacheHit
+//
+// Line fills are critical word first: the Dram burst starts at the 68k's word and wraps around the line
+// (sequential burst type in the Dram's mode register), and the 68k gets Dtack as soon as that word is in the
+// Cache. The rest of the line fills while the 68k carries on, using the address held in FillAddress
+//
+// WriteBack = 0: write through, a write goes straight to the Dram and invalidates any line holding it
+// WriteBack = 1: write back with write allocate. A write hit only updates the Cache and marks the line dirty,
+// a write miss fills the line from Dram first then writes the word into it. A dirty victim chosen by the
+// LRU bits is written back to Dram (8 single word writes) before the new line is read in. Writes to the
+// uncached alias go to Dram and also update the word if it is in the Cache, but an uncached read does not
+// see dirty data still in the Cache, so flush first.
+//
+// FlushCache_H: a rising edge writes back every dirty line and invalidates the whole Cache (e.g. before DMA
+// or flash programming). FlushBusy_H stays high until it is finished. The 512kb set associative
+// project's MC68K.bdf puts them on OutPortC[0] and InPortC[0], see the monitor's TF command
+//
+// This project holds only the controller, there is no schematic for it here, so WriteBack = 1 and the flush
+// are not supported in it: keep WriteBack = 0 and tie FlushCache_H low unless the schematic is wired like
+// the 512kb set associative project's (FlushCache_H/FlushBusy_H to the ports, and the sets' data, UDS and
+// LDS from DataBusOutToCache/DataCacheUDS_L/DataCacheLDS_L)
+//
 // Copyright PJ Davies August 2017
 ///////////////////////////////////////////////////////////////////////////////////////
 
@@ -54,10 +79,21 @@ module M68kAssociativeCacheController_Verilog (
 		output reg unsigned [2:0] LRUBits_Out,	
 		output reg LRU_WE_L,
 
+		// data written into the Cache, Dram data during a line fill or 68k data for a write (WriteBack = 1)
+		output reg unsigned [15:0] DataBusOutToCache,
+		output reg DataCacheUDS_L,												// byte enables for the above, active low
+		output reg DataCacheLDS_L,
+
+		input FlushCache_H,														// rising edge = write back dirty lines and invalidate the Cache
+		output FlushBusy_H,														// high until the flush is done
+
 		// debugging only
 		output unsigned [4:0] CacheState	
 	);
 
+	parameter	CASLatency = 2;											// Dram CAS latency in clocks, 2 or 3
+	parameter	WriteBack = 0;												// 0 = write through, 1 = write back with write allocate
+
 
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -74,6 +110,10 @@ module M68kAssociativeCacheController_Verilog (
 	parameter	EndBurstFill 					= 5'b01000;
 	parameter	WriteDataToDram 				= 5'b01001;
 	parameter	WaitForEndOfCacheRead		= 5'b01010;
+	parameter	CheckVictim						= 5'b01011;
+	parameter	EvictWrite						= 5'b01100;
+	parameter	EvictNextWord					= 5'b01101;
+	parameter	FlushCache						= 5'b01110;
 	
 	// 5 bit variables to hold current and next state of the state machine
 	reg unsigned [4:0] CurrentState;					// holds the current state of the Cache controller
@@ -92,10 +132,56 @@ module M68kAssociativeCacheController_Verilog (
 	reg  LRUBits_Load_H;
 	reg  unsigned [2:0]  LRUBits;
 
+	// Dram is also decoded at hex 0C00 0000 - 0FFF FFFF, an alias with address bit 26 set, which is never cached
+	wire Uncached_H = AddressBusInFrom68k[26];
+	reg unsigned [15:0] CriticalWord;					// word the 68k asked for, first in the burst and caught as it goes past
+
+	reg unsigned [31:0] FillAddress;						// address of the line being filled, the 68k may move on before the end
+	reg Restarted_H;											// 68k has had its word and ended its bus cycle during the fill
+
+	// write back: a dirty bit and a copy of the tag for each block of each set, the tag is needed to
+	// rebuild the Dram address of a dirty victim (the tag memory only gives us hit signals)
+	reg unsigned [3:0] DirtyBits [0:7];
+	reg unsigned [24:0] LineTag [0:31];					// indexed by {set, block}
+	reg unsigned [3:0] DirtyBit_WE_L;						// 4 bits for 4 blocks to store a dirty bit
+	reg DirtyBitOut_H;
+
+	// eviction of a dirty line, word by word, and the flush which walks every line of every set
+	reg unsigned [2:0] EvictWord;							// word of the victim being written back
+	reg EvictWordReset_H;
+	reg EvictWordNext_H;
+	reg unsigned [4:0] FlushLine;							// {set, block} being flushed
+	reg FlushStart_H;
+	reg FlushNext_H;
+	reg FlushEnd_H;
+	reg Flushing_H;
+	reg FlushPending_H;
+	reg LastFlushCache_H;
+
+	wire unsigned [2:0] EvictIndex = (Flushing_H == 1'b1) ? FlushLine[4:2] : AddressBusInFrom68k[6:4];
+	wire unsigned [24:0] VictimTag = LineTag[{EvictIndex, ReplaceBlockNumber}];
+
+	// pseudo LRU update making the block(s) in Hit the most recently used
+	function [2:0] LRUTouch;
+		input [2:0] Bits;
+		input [3:0] Hit;
+		begin
+			if (Hit[0] == 1'b1)
+				LRUTouch = {Bits[2], 2'b11};
+			else if (Hit[1] == 1'b1)
+				LRUTouch = {Bits[2], 2'b01};
+			else if (Hit[2] == 1'b1)
+				LRUTouch = {1'b1, Bits[1], 1'b0};
+			else
+				LRUTouch = {1'b0, Bits[1], 1'b0};
+		end
+	endfunction
+
 	
 	
 	// start
 	assign CacheState = CurrentState;								// for debugging purposes only
+	assign FlushBusy_H = FlushPending_H | Flushing_H;
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // concurrent process state registers
@@ -120,6 +206,24 @@ module M68kAssociativeCacheController_Verilog (
 		else
 			BurstCounter <= BurstCounter + 1;			// else count
 	end
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Early restart: hold on to the 68k's word (the first of the burst) so it can be given to the 68k while the rest of the
+// line is filled, it is also the only copy for an uncached read. Remember the line address and whether the 68k has gone
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	always@(posedge Clock)
+	begin
+		if(CurrentState == BurstFill && BurstCounter == 0)
+			CriticalWord <= DataBusInFromDram;
+
+		if(CurrentState == ReadDataFromDramIntoCache) begin
+			FillAddress <= AddressBusInFrom68k;
+			Restarted_H <= 0;
+		end
+		else if(CurrentState == BurstFill && AS_L == 1'b1)
+			Restarted_H <= 1;
+	end
 	
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // register to store the Set Replacement Number/Block: Used to provide a 2 bit address to select a way/block
@@ -141,6 +245,63 @@ module M68kAssociativeCacheController_Verilog (
 			LRUBits	<= LRUBits_In;			// store the chosen block number
 	end
 
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// dirty bits and tag copies, written alongside the valid bits and tags
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	always@(posedge Clock)
+	begin
+		if(DirtyBit_WE_L[0] == 0) DirtyBits[Index][0] <= DirtyBitOut_H;
+		if(DirtyBit_WE_L[1] == 0) DirtyBits[Index][1] <= DirtyBitOut_H;
+		if(DirtyBit_WE_L[2] == 0) DirtyBits[Index][2] <= DirtyBitOut_H;
+		if(DirtyBit_WE_L[3] == 0) DirtyBits[Index][3] <= DirtyBitOut_H;
+
+		if(TagCache_WE_L[0] == 0) LineTag[{Index, 2'b00}] <= TagDataOut;
+		if(TagCache_WE_L[1] == 0) LineTag[{Index, 2'b01}] <= TagDataOut;
+		if(TagCache_WE_L[2] == 0) LineTag[{Index, 2'b10}] <= TagDataOut;
+		if(TagCache_WE_L[3] == 0) LineTag[{Index, 2'b11}] <= TagDataOut;
+	end
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// eviction word counter and flush line counter. A flush is requested on a rising edge of FlushCache_H and
+// waits for the 68k's current access to finish
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	always@(posedge Clock)
+	begin
+		if(EvictWordReset_H == 1)
+			EvictWord <= 3'b000;
+		else if(EvictWordNext_H == 1)
+			EvictWord <= EvictWord + 1;
+
+		if(FlushStart_H == 1)
+			FlushLine <= 5'b00000;
+		else if(FlushNext_H == 1)
+			FlushLine <= FlushLine + 1;
+	end
+
+	always@(posedge Clock, negedge Reset_L)
+	begin
+		if(Reset_L == 0) begin
+			Flushing_H <= 0;
+			FlushPending_H <= 0;
+			LastFlushCache_H <= 0;
+		end
+		else begin
+			LastFlushCache_H <= FlushCache_H;
+
+			if(FlushStart_H == 1) begin
+				Flushing_H <= 1;
+				FlushPending_H <= 0;
+			end
+			else if(FlushCache_H == 1 && LastFlushCache_H == 0)
+				FlushPending_H <= 1;
+
+			if(FlushEnd_H == 1)
+				Flushing_H <= 0;
+		end
+	end
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // next state and output logic
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////	
@@ -151,14 +312,17 @@ module M68kAssociativeCacheController_Verilog (
 	
 		DataBusOutTo68k 					<= DataBusInFromCache;
 		DataBusOutToDramController 	<= DataBusInFrom68k;
+		DataBusOutToCache					<= DataBusInFromDram;						// Cache is normally filled from the Dram
+		DataCacheUDS_L						<= 0;
+		DataCacheLDS_L						<= 0;
 
 		// default is to give the Dram the 68k's signals directly (unless we want to change something)	
 		
 		AddressBusOutToDramController[31:4]	<= AddressBusInFrom68k[31:4];
-		AddressBusOutToDramController[3:1]	<= 3'b000;								// all reads to Dram have lower 3 address lines set to 0 for a Cache line regardless of 68k address
+		AddressBusOutToDramController[3:1]	<= AddressBusInFrom68k[3:1];		// line fills start at the 68k's word and wrap around the line
 		AddressBusOutToDramController[0] 	<= 0;										// to avoid inferring a latch for this bit
 		
-		TagDataOut							<= AddressBusInFrom68k[31:7];				// tag is 25 bits
+		TagDataOut							<= {AddressBusInFrom68k[31:27], 1'b0, AddressBusInFrom68k[25:7]};	// tag is 25 bits, uncached alias has the same tag as the cached address
 		Index									<= AddressBusInFrom68k[6:4];				// cache Line is 3 bits for 8 Lines 4 way cache
 		
 		UDS_DramController_L				<= UDS_L;
@@ -181,6 +345,14 @@ module M68kAssociativeCacheController_Verilog (
 		LRUBits_Out							<= 3'b000;
 		LRU_WE_L								<= 1;												// dont write	
 		LRUBits_Load_H						<= 0;
+
+		DirtyBit_WE_L						<= 4'b1111;										// don't write dirty bits
+		DirtyBitOut_H						<= 0;
+		EvictWordReset_H					<= 0;
+		EvictWordNext_H					<= 0;
+		FlushStart_H						<= 0;
+		FlushNext_H							<= 0;
+		FlushEnd_H							<= 0;
 		
 		NextState 							<= Idle ;										// default is to go to this state
 			
@@ -218,6 +390,10 @@ module M68kAssociativeCacheController_Verilog (
 				// clear the LRU bits for each cache Line
 				LRUBits_Out						<= 3'b000;
 				LRU_WE_L							<= 0;
+
+				// and the dirty bits
+				DirtyBitOut_H					<= 0;
+				DirtyBit_WE_L					<= 4'b0000;
 			end
 		end
 
@@ -229,21 +405,41 @@ module M68kAssociativeCacheController_Verilog (
 			if (AS_L == 1'b0 & DramSelect68k_H == 1'b1) begin
 				LRUBits_Load_H <= 1'b1; // update LRU bits
 
-				if (WE_L == 1'b1) begin // read request
+				if (WE_L == 1'b1 & Uncached_H == 1'b1) begin // uncached read, straight to the Dram, LRU bits left alone
+					UDS_DramController_L <= 1'b0; // activate
+					LDS_DramController_L <= 1'b0; // activate
+					DramSelectFromCache_L <= 1'b0; // activate
+					NextState <= ReadDataFromDramIntoCache;
+
+				end else if (WE_L == 1'b1 & ValidHit_H > 4'b0) begin // read hit, data and Dtack next clock
+					UDS_DramController_L <= 1'b0; // activate
+					LDS_DramController_L <= 1'b0; // activate
+					WordAddress <= AddressBusInFrom68k[3:1];
+					NextState <= WaitForEndOfCacheRead;
+
+				end else if (WE_L == 1'b1) begin // read request
 					UDS_DramController_L <= 1'b0; // activate
 					LDS_DramController_L <= 1'b0; // activate
 					NextState <= CheckForCacheHit;
 
+				end else if (WriteBack == 1 & Uncached_H == 1'b0) begin // write back, look for the line first
+					NextState <= CheckForCacheHit;
+
 				end else begin // write request
 					ValidBitOut_H <= 1'b0;
 					
-					// if we have a hit, invalidate the corresponding line
-					ValidBit_WE_L <= ValidHit_H;
+					// if we have a hit, invalidate the corresponding line (write back updates it in WriteDataToDram instead)
+					if (WriteBack == 0)
+						ValidBit_WE_L <= ~ValidHit_H;											// write enables are active low, only the way that hit
 
 					// bypass the cache to write
 					DramSelectFromCache_L <= 1'b0; // activate
 					NextState <= WriteDataToDram;
 				end
+
+			end else if (FlushPending_H == 1'b1) begin // nothing from the 68k, go flush the cache
+				FlushStart_H <= 1'b1;
+				NextState <= FlushCache;
 			end
 		end
 		
@@ -256,26 +452,30 @@ module M68kAssociativeCacheController_Verilog (
 			UDS_DramController_L <= 1'b0; // activate
 			LDS_DramController_L <= 1'b0; // activate
 
-			if (ValidHit_H > 4'b0) begin // cache hit
+			if (WE_L == 1'b0 & UDS_L == 1'b1 & LDS_L == 1'b1) begin // write (WriteBack = 1 only), data not on the bus yet
+				NextState <= CheckForCacheHit;
+
+			end else if (ValidHit_H > 4'b0 & WE_L == 1'b0) begin // write hit, update the word in the cache and mark the line dirty
 				WordAddress <= AddressBusInFrom68k[3:1];
+				DataBusOutToCache <= DataBusInFrom68k;
+				DataCacheUDS_L <= UDS_L;
+				DataCacheLDS_L <= LDS_L;
+				DataCache_WE_L <= ~ValidHit_H;
+
+				DirtyBitOut_H <= 1'b1;
+				DirtyBit_WE_L <= ~ValidHit_H;
+
 				DtackTo68k_L <= 1'b0; // activate
 				NextState <= WaitForEndOfCacheRead;
 
-				// update LRU bits
-				if (LRUBits == 3'bx00) begin
-					LRUBits_Out <= {LRUBits[2], 2'b11};
-				end else if (LRUBits == 3'bx10) begin
-					LRUBits_Out <= {LRUBits[2], 2'b01};
-				end else if (LRUBits == 3'b0x1) begin
-					LRUBits_Out <= {1'b1, LRUBits[1], 1'b0};
-				end else begin
-					LRUBits_Out <= {1'b0, LRUBits[1], 1'b0};
-				end
-
-				LRU_WE_L <= 1'b0; // activate
+			end else if (ValidHit_H > 4'b0) begin // cache hit Idle did not see
+				WordAddress <= AddressBusInFrom68k[3:1];
+				DtackTo68k_L <= 1'b0; // activate
+				NextState <= WaitForEndOfCacheRead;
 
 			end else begin // no cache hit
-				DramSelectFromCache_L <= 1'b0; // activate
+				if (WriteBack == 0)
+					DramSelectFromCache_L <= 1'b0; // activate
 
 				// decide which cache line to replace and update LRU bits
 				if (LRUBits == 3'bx00) begin
@@ -294,12 +494,125 @@ module M68kAssociativeCacheController_Verilog (
 
 				LRU_WE_L <= 1'b0; // activate
 				LoadReplacementBlockNumber_H <= 1'b1; // activate
+
+				if (WriteBack == 1)
+					NextState <= CheckVictim; // victim might have to be written back first
+				else
+					NextState <= ReadDataFromDramIntoCache;
+			end
+		end
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Write back only: the block to replace is now in ReplaceBlockNumber, write it back if it is dirty
+// (dirty bits are only ever set on valid lines) otherwise start the line fill
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+		else if(CurrentState == CheckVictim) begin
+			if (DirtyBits[AddressBusInFrom68k[6:4]][ReplaceBlockNumber] == 1'b1) begin
+				EvictWordReset_H <= 1'b1;
+				NextState <= EvictWrite;
+			end else begin
+				UDS_DramController_L <= 1'b0; // activate
+				LDS_DramController_L <= 1'b0; // activate
+				WE_DramController_L <= 1'b1; // a fill is a read, even for a write miss
+				DramSelectFromCache_L <= 1'b0; // activate
 				NextState <= ReadDataFromDramIntoCache;
 			end
 		end
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Write a dirty victim back to Dram, one word per Dram write cycle. The victim's tag is put out to
+// the tag comparators so its block gives a hit and the data mux selects it. AS stays low across the
+// whole line so an arbiter in front of the Dram controller keeps us granted
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+		else if(CurrentState == EvictWrite) begin
+			Index <= EvictIndex;
+			TagDataOut <= VictimTag;
+			WordAddress <= EvictWord;
+
+			AddressBusOutToDramController <= {VictimTag, EvictIndex, EvictWord, 1'b0};
+			DataBusOutToDramController <= DataBusInFromCache;
+
+			AS_DramController_L <= 1'b0; // activate
+			WE_DramController_L <= 1'b0; // activate
+			UDS_DramController_L <= 1'b0; // activate
+			LDS_DramController_L <= 1'b0; // activate
+			DramSelectFromCache_L <= 1'b0; // activate
+
+			if (DtackFromDram_L == 1'b0) begin
+				NextState <= EvictNextWord;
+			end else begin
+				NextState <= EvictWrite;
+			end
+		end
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// end the word's write cycle (strobes and select high) and wait for the Dram controller's Dtack
+// to go away, then the next word or, after the last one, the line fill (or back to the flush)
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+		else if(CurrentState == EvictNextWord) begin
+			Index <= EvictIndex;
+			TagDataOut <= VictimTag;
+			WordAddress <= EvictWord;
+
+			AddressBusOutToDramController <= {VictimTag, EvictIndex, EvictWord, 1'b0};
+			DataBusOutToDramController <= DataBusInFromCache;
+
+			AS_DramController_L <= 1'b0; // activate
+			WE_DramController_L <= 1'b0; // activate
+			UDS_DramController_L <= 1'b1; // deactivate
+			LDS_DramController_L <= 1'b1; // deactivate
+
+			NextState <= EvictNextWord;
+			if (DtackFromDram_L == 1'b1) begin
+				EvictWordNext_H <= 1'b1;
+				NextState <= EvictWrite;
+
+				if (EvictWord == 3'b111) begin // line written back, it is clean
+					DirtyBitOut_H <= 1'b0;
+					DirtyBit_WE_L[ReplaceBlockNumber] <= 1'b0;
+
+					if (Flushing_H == 1'b1) begin
+						NextState <= FlushCache;
+					end else begin
+						NextState <= ReadDataFromDramIntoCache;
+					end
+				end
+			end
+		end
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Flush: step through every block of every set, writing back dirty ones and invalidating them all.
+// FlushLine is {set, block}, a dirty line goes through EvictWrite/EvictNextWord and comes back here
+// clean
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+		else if(CurrentState == FlushCache) begin
+			Index <= FlushLine[4:2];
+			NextState <= FlushCache;
+
+			if (DirtyBits[FlushLine[4:2]][FlushLine[1:0]] == 1'b1) begin
+				ReplaceBlockNumberData <= FlushLine[1:0];
+				LoadReplacementBlockNumber_H <= 1'b1;
+				EvictWordReset_H <= 1'b1;
+				NextState <= EvictWrite;
+			end else begin
+				ValidBitOut_H <= 1'b0;
+				ValidBit_WE_L[FlushLine[1:0]] <= 1'b0;
+				FlushNext_H <= 1'b1;
+
+				if (FlushLine == 5'b11111) begin
+					FlushEnd_H <= 1'b1;
+					NextState <= Idle;
+				end
+			end
+		end
+
 ///////////////////////////////////////////////////////////////////////////////////////////////
 // Got a Cache hit, so give the 68k the Cache data now then wait for the 68k to end bus cycle 
+// the hit block becomes the most recently used, off the path to Dtack (also used for write hits)
 ///////////////////////////////////////////////////////////////////////////////////////////////
 
 		else if(CurrentState == WaitForEndOfCacheRead) begin		
@@ -310,6 +623,8 @@ module M68kAssociativeCacheController_Verilog (
 			DtackTo68k_L <= 1'b0; // activate
 
 			if (AS_L == 1'b0) begin
+				LRUBits_Out <= LRUTouch(LRUBits, ValidHit_H);
+				LRU_WE_L <= 1'b0; // activate
 				NextState <= WaitForEndOfCacheRead;
 			end
 		end
@@ -322,6 +637,7 @@ module M68kAssociativeCacheController_Verilog (
 		else if(CurrentState == ReadDataFromDramIntoCache) begin
 			UDS_DramController_L <= 1'b0; // activate
 			LDS_DramController_L <= 1'b0; // activate
+			WE_DramController_L <= 1'b1; // read, also for a write allocate
 
 			DramSelectFromCache_L <= 1'b0; //activate
 			NextState <= ReadDataFromDramIntoCache;
@@ -332,19 +648,25 @@ module M68kAssociativeCacheController_Verilog (
 
 			ValidBitOut_H <= 1'b1; // activate
 
-			// ID which block will be storing the new data
-			if (ReplaceBlockNumber == 2'b00) begin
+			// ID which block will be storing the new data, none for an uncached read
+			if (Uncached_H == 1'b1) begin
+				// leave the tags and valid bits alone
+			end else if (ReplaceBlockNumber == 2'b00) begin
 				TagCache_WE_L[0] <= 1'b0; // activate
 				ValidBit_WE_L[0] <= 1'b0; // activate
+				DirtyBit_WE_L[0] <= 1'b0; // new line is clean
 			end else if (ReplaceBlockNumber == 2'b01) begin
 				TagCache_WE_L[1] <= 1'b0; // activate
 				ValidBit_WE_L[1] <= 1'b0; // activate
+				DirtyBit_WE_L[1] <= 1'b0; // new line is clean
 			end else if (ReplaceBlockNumber == 2'b10) begin
 				TagCache_WE_L[2] <= 1'b0; // activate
 				ValidBit_WE_L[2] <= 1'b0; // activate
+				DirtyBit_WE_L[2] <= 1'b0; // new line is clean
 			end else begin
 				TagCache_WE_L[3] <= 1'b0; // activate
 				ValidBit_WE_L[3] <= 1'b0; // activate
+				DirtyBit_WE_L[3] <= 1'b0; // new line is clean
 			end
 		end
 						
@@ -355,8 +677,10 @@ module M68kAssociativeCacheController_Verilog (
 		else if(CurrentState == CASDelay1) begin						
 			UDS_DramController_L <= 1'b0; // activate
 			LDS_DramController_L <= 1'b0; // activate
+			WE_DramController_L <= 1'b1;
 
 			DramSelectFromCache_L <= 1'b0; // activate
+			BurstCounterReset_L <= 1'b0; // count the rest of the CAS latency in CASDelay2
 			NextState <= CASDelay2;
 		end
 		
@@ -367,11 +691,16 @@ module M68kAssociativeCacheController_Verilog (
 		else if(CurrentState == CASDelay2) begin						
 			UDS_DramController_L <= 1'b0; // activate
 			LDS_DramController_L <= 1'b0; // activate
+			WE_DramController_L <= 1'b1;
 
 			DramSelectFromCache_L <= 1'b0; // activate
 
-			BurstCounterReset_L <= 1'b0; // activate
-			NextState <= BurstFill;
+			if(BurstCounter >= CASLatency - 2) begin // latency used up, data arrives next clock
+				BurstCounterReset_L <= 1'b0; // activate
+				NextState <= BurstFill;
+			end else begin
+				NextState <= CASDelay2;
+			end
 		end
 
 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -381,16 +710,29 @@ module M68kAssociativeCacheController_Verilog (
 		else if(CurrentState == BurstFill) begin
 			UDS_DramController_L <= 1'b0; // activate
 			LDS_DramController_L <= 1'b0; // activate
+			WE_DramController_L <= 1'b1;
 
 			DramSelectFromCache_L <= 1'b0; // activate
 
+			Index <= FillAddress[6:4];
+
 			NextState <= BurstFill;
 			if (BurstCounter == 16'd8) begin
 				NextState <= EndBurstFill;
 			end else begin
-				WordAddress <= BurstCounter[2:0];
+				WordAddress <= BurstCounter[2:0] + FillAddress[3:1]; // burst wraps around the line from the 68k's word
+
+				// write allocate: the 68k's word comes first, merge the bytes it is writing into it
+				if (BurstCounter == 16'd0 & WE_L == 1'b0) begin
+					DataBusOutToCache[15:8] <= (UDS_L == 1'b0) ? DataBusInFrom68k[15:8] : DataBusInFromDram[15:8];
+					DataBusOutToCache[7:0] <= (LDS_L == 1'b0) ? DataBusInFrom68k[7:0] : DataBusInFromDram[7:0];
+					DirtyBitOut_H <= 1'b1;
+					DirtyBit_WE_L[ReplaceBlockNumber] <= 1'b0;
+				end
 
-				if (ReplaceBlockNumber == 2'b00) begin
+				if (FillAddress[26] == 1'b1) begin
+					// uncached, the word is caught in CriticalWord instead
+				end else if (ReplaceBlockNumber == 2'b00) begin
 					DataCache_WE_L[0] <= 1'b0; // activate
 				end else if (ReplaceBlockNumber == 2'b01) begin
 					DataCache_WE_L[1] <= 1'b0; // activate
@@ -400,26 +742,42 @@ module M68kAssociativeCacheController_Verilog (
 					DataCache_WE_L[3] <= 1'b0; // activate
 				end
 			end
+
+			if (BurstCounter != 16'd0 & Restarted_H == 1'b0 & AS_L == 1'b0) begin // 68k's word is in, let it carry on
+				DtackTo68k_L <= 1'b0; // activate
+				DataBusOutTo68k <= CriticalWord;
+			end
 		end
 			
 ///////////////////////////////////////////////////////////////////////////////////////
-// End Burst fill and give the CPU the data from the cache
+// End Burst fill, give the CPU its word if it has not already had it during the fill
 ///////////////////////////////////////////////////////////////////////////////////////
 		else if(CurrentState == EndBurstFill) begin							// wait for Dram case signal to go low
-			UDS_DramController_L <= 1'b0; // activate
-			LDS_DramController_L <= 1'b0; // activate
-
 			DramSelectFromCache_L <= 1'b1; // deactivate
-			DtackTo68k_L <= 1'b0; // activate
 
-			WordAddress <= AddressBusInFrom68k[3:1];
-			DataBusOutTo68k <= DataBusInFromCache; // give data to CPU
+			if (Restarted_H == 1'b1) begin // 68k has already gone, end the Dram controller's cycle before the next access
+				UDS_DramController_L <= 1'b1; // deactivate
+				LDS_DramController_L <= 1'b1; // deactivate
+
+				if (DtackFromDram_L == 1'b1) begin
+					NextState <= Idle;
+				end else begin
+					NextState <= EndBurstFill;
+				end
 
-			// wait for 68k to terminate read
-			if (AS_L == 1'b1 | DramSelect68k_H == 1'b0) begin
-				NextState <= Idle;
 			end else begin
-				NextState <= EndBurstFill;
+				UDS_DramController_L <= 1'b0; // activate
+				LDS_DramController_L <= 1'b0; // activate
+				DtackTo68k_L <= 1'b0; // activate
+
+				DataBusOutTo68k <= CriticalWord; // give the word caught during the burst to the CPU
+
+				// wait for 68k to terminate the bus cycle
+				if (AS_L == 1'b1 | DramSelect68k_H == 1'b0) begin
+					NextState <= Idle;
+				end else begin
+					NextState <= EndBurstFill;
+				end
 			end
 		end
 		
@@ -432,6 +790,15 @@ module M68kAssociativeCacheController_Verilog (
 			DramSelectFromCache_L <= 1'b0; // activate
 			DtackTo68k_L = DtackFromDram_L;
 
+			// write back: an uncached write also updates the word if the line is in the cache
+			if (WriteBack == 1 & (UDS_L == 1'b0 | LDS_L == 1'b0)) begin
+				WordAddress <= AddressBusInFrom68k[3:1];
+				DataBusOutToCache <= DataBusInFrom68k;
+				DataCacheUDS_L <= UDS_L;
+				DataCacheLDS_L <= LDS_L;
+				DataCache_WE_L <= ~ValidHit_H;
+			end
+
 			// wait for 68k to terminate write
 			if (AS_L == 1'b1 | DramSelect68k_H == 1'b0) begin
 				NextState <= Idle;
@@ -4,6 +4,34 @@
 // designed to work with TG68 (68000 based) cpu with 16 bit data bus and 32 bit address bus
 // separate upper and lowe data stobes for individual byte and also 16 bit word access
 //
+// CASLatency parameter must match the CAS latency programmed by the Dram controller
+//
+// A read hit is decided in Idle from the tag compare of the 68k's address, so Dtack goes out in the next clock.
+// A miss goes on to CheckForCacheHit
+//
+// Line fills are critical word first: the Dram burst starts at the 68k's word and wraps around the line
+// (sequential burst type in the Dram's mode register), and the 68k gets Dtack as soon as that word is in the
+// Cache. The rest of the line fills while the 68k carries on, using the address held in FillAddress
+//
+// Next line prefetch (Prefetch = 1): after a demand fill of line N, line N+1 is filled in the background
+// while the Cache controller would otherwise be idle, if it is not already in the Cache. Two streams are
+// tracked, and a demand read hit on a stream's prefetched line moves that stream on to the line after.
+// A prefetch only starts when the 68k is not accessing the Dram and is dropped (tried again later) if the
+// 68k starts an access before the Dram read has been requested. Once the Dram read is under way it
+// finishes, so a demand access waits for the rest of that burst. PrefetchCount and PrefetchHits count
+// prefetched lines and prefetched lines the 68k went on to read, i.e. the prefetch accuracy. They are read a
+// byte at a time: OutPortD[1..0] drives PrefetchCounterSelect and InPortD reads PrefetchCounterOut (monitor 'TA')
+//
+// Victim cache (VictimCache = 1): the last 4 lines a fill threw out of the Cache are kept in a small fully
+// associative buffer, looked up alongside the Cache's own tag compare. A read that misses in the Cache but hits
+// there gets its word at once and the two lines are swapped, so a loop whose code and data share an index no
+// longer goes to the Dram every time. The data memory has one (clocked) port, so while a fill's burst comes in
+// the old line is read out into the victim buffer and the new line is held in LineBuffer, then written into the
+// Cache after the burst (the 68k has its word by then). A fill of an invalid line writes the Cache directly
+//
+// Writes are write through with update on hit: the write always goes to the Dram, and if the line is in
+// the Cache the word is updated in place as well (UDS/LDS select the bytes) so the line stays valid
+//
 // Copyright PJ Davies August 2017
 ///////////////////////////////////////////////////////////////////////////////////////
 
@@ -48,9 +76,21 @@ module M68kCacheController_Verilog (
 		output reg ValidBitOut_H,												// indicates the cache line is valid
 		output reg unsigned [12:4] Index,										// 9 bit index in this example cache
 
-		output unsigned [4:0] CacheState										// for debugging
+		output reg unsigned [15:0] DataBusOutToCache,						// data written into the Cache, Dram data during a line fill or 68k data for a write hit
+		output reg DataCacheUDS_L,												// byte enables for the above, active low
+		output reg DataCacheLDS_L,
+
+		output unsigned [4:0] CacheState,									// for debugging
+
+		// prefetch counters, read a byte at a time through a parallel port
+		input unsigned [1:0] PrefetchCounterSelect,						// 0/1 = PrefetchCount bits 7-0/15-8, 2/3 = PrefetchHits bits 7-0/15-8
+		output unsigned [7:0] PrefetchCounterOut
 	);
 
+	parameter	CASLatency = 2;											// Dram CAS latency in clocks, 2 or 3
+	parameter	Prefetch = 1;												// 1 = next line prefetch, 0 = off
+	parameter	VictimCache = 0;											// 1 = 4 line victim cache, 0 = off (see lab4/timing.txt)
+
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Initialisation States
@@ -66,6 +106,11 @@ module M68kCacheController_Verilog (
 	parameter	EndBurstFill = 5'b01000 ;
 	parameter	WriteDataToDram = 5'b01001 ;
 	parameter	WaitForEndOfCacheRead = 5'b01010 ;
+	parameter	PrefetchStart = 5'b01011 ;
+	parameter	PrefetchCheck = 5'b01100 ;
+	parameter	VictimSave = 5'b01101 ;
+	parameter	VictimRestore = 5'b01110 ;
+	parameter	WriteFillLine = 5'b01111 ;
 	
 	
 	// 5 bit variables to hold current and next state of the state machine
@@ -76,6 +121,81 @@ module M68kCacheController_Verilog (
 	reg unsigned [15:0] BurstCounter;						// counts for at least 8 during a burst Dram read also counts lines when flusing the cache
 	reg BurstCounterReset_L;									// reset for the above counter
 
+	// Dram is also decoded at hex 0C00 0000 - 0FFF FFFF, an alias with address bit 26 set, which is never cached
+	wire Uncached_H = AddressBusInFrom68k[26];
+	reg unsigned [15:0] CriticalWord;					// word the 68k asked for, first in the burst and caught as it goes past
+
+	reg unsigned [31:0] FillAddress;						// address of the line being filled, the 68k may move on before the end
+	reg Restarted_H;											// no 68k waiting on the fill, it has had its word and gone, or this is a prefetch
+
+	// next line prefetch, each stream holds the line to prefetch (pending) or the line it prefetched last
+	reg unsigned [27:0] StreamLine [0:1];					// 68k address bits [31:4]
+	reg unsigned [1:0] StreamPending_H;
+	reg unsigned [1:0] StreamFetched_H;						// StreamLine was actually read in by a prefetch
+	reg StreamReplace;											// stream to take over for a new sequence
+	reg PrefetchStream;											// stream being prefetched
+	reg Prefetching_H;											// the current line fill is a prefetch
+	reg PrefetchGo_H;												// start the prefetch fill
+	reg PrefetchEnd_H;											// prefetch fill finished
+	reg PrefetchFound_H;											// line was already in the cache
+
+	wire unsigned [31:0] PrefetchAddress = {StreamLine[PrefetchStream], 4'b0000};
+	wire unsigned [27:0] DemandLine = AddressBusInFrom68k[31:4];
+
+	reg unsigned [15:0] PrefetchCount;						// lines prefetched
+	reg unsigned [15:0] PrefetchHits;							// prefetched lines the 68k then read
+	assign PrefetchCounterOut = (PrefetchCounterSelect == 2'd0) ? PrefetchCount[7:0] :
+										 (PrefetchCounterSelect == 2'd1) ? PrefetchCount[15:8] :
+										 (PrefetchCounterSelect == 2'd2) ? PrefetchHits[7:0] : PrefetchHits[15:8];
+
+	// streams only run within the cacheable Dram window, hex 0800 0000 - 0BFF FFFF (address bits [31:26] = 000010),
+	// the line after the top one is in the uncached alias
+	wire unsigned [27:0] FillNextLine = FillAddress[31:4] + 28'd1;
+	wire unsigned [27:0] DemandNextLine = DemandLine + 28'd1;
+	wire FillNextCacheable_H = (FillNextLine[27:22] == 6'b000010);
+	wire DemandNextCacheable_H = (DemandNextLine[27:22] == 6'b000010);
+	wire PrefetchCacheable_H = (PrefetchAddress[31:26] == 6'b000010);
+
+	// victim cache, lines recently thrown out of the Cache
+	reg unsigned [27:0] VictimLine [0:3];					// 68k address bits [31:4]
+	reg unsigned [3:0] VictimValid_H;
+	reg unsigned [15:0] VictimData [0:31];					// 8 words a line, indexed by {entry, word}
+	reg unsigned [1:0] VictimNext;							// entry to replace next, round robin
+	reg unsigned [1:0] SwapWay;								// entry being swapped with the Cache line
+	reg VictimSwapGo_H;											// victim hit, start the swap
+	reg unsigned [15:0] LineBuffer [0:7];					// new line during a fill, or the Cache's line during a swap
+	reg unsigned [18:0] LineTag [0:511];						// copy of the tag memory, which only gives us a hit signal
+	reg unsigned [18:0] EvictTag;								// tag and valid bit of the line a fill or swap replaces
+	reg EvictValid_H;
+
+	wire unsigned [27:0] EvictLine = {EvictTag[18:14], 1'b0, EvictTag[12:0], FillAddress[12:4]};
+	wire unsigned [27:0] CachedLine = {AddressBusInFrom68k[31:27], 1'b0, AddressBusInFrom68k[25:4]};	// uncached alias too
+	wire SaveVictim_H = (VictimCache == 1 & EvictValid_H == 1 & FillAddress[26] == 0);			// fill replaces a line
+
+	wire unsigned [3:0] DemandMatch_H = {VictimValid_H[3] & (VictimLine[3] == CachedLine),
+													 VictimValid_H[2] & (VictimLine[2] == CachedLine),
+													 VictimValid_H[1] & (VictimLine[1] == CachedLine),
+													 VictimValid_H[0] & (VictimLine[0] == CachedLine)};
+
+	wire unsigned [3:0] PrefetchMatch_H = {VictimValid_H[3] & (VictimLine[3] == PrefetchAddress[31:4]),
+														VictimValid_H[2] & (VictimLine[2] == PrefetchAddress[31:4]),
+														VictimValid_H[1] & (VictimLine[1] == PrefetchAddress[31:4]),
+														VictimValid_H[0] & (VictimLine[0] == PrefetchAddress[31:4])};
+
+	function [1:0] VictimWay;
+		input [3:0] Match;
+		begin
+			if (Match[1] == 1'b1)
+				VictimWay = 2'd1;
+			else if (Match[2] == 1'b1)
+				VictimWay = 2'd2;
+			else if (Match[3] == 1'b1)
+				VictimWay = 2'd3;
+			else
+				VictimWay = 2'd0;
+		end
+	endfunction
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // concurrent process state registers
 // this process RECORDS the current state of the system.
@@ -102,7 +222,173 @@ module M68kCacheController_Verilog (
 		else
 			BurstCounter <= BurstCounter + 1;
 	end
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Early restart: hold on to the 68k's word (the first of the burst) so it can be given to the 68k while the rest of the
+// line is filled, it is also the only copy for an uncached read. Remember the line address and whether the 68k has gone
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	always@(posedge Clock)
+	begin
+		if(CurrentState == BurstFill && BurstCounter == 0)
+			CriticalWord <= DataBusInFromDram;
+		else if(VictimSwapGo_H == 1'b1)
+			CriticalWord <= VictimData[{VictimWay(DemandMatch_H), AddressBusInFrom68k[3:1]}];
+
+		if(VictimSwapGo_H == 1'b1) begin
+			FillAddress <= AddressBusInFrom68k;
+			Restarted_H <= 0;
+		end
+		else if(CurrentState == ReadDataFromDramIntoCache && Prefetching_H == 1'b1) begin
+			FillAddress <= PrefetchAddress;
+			Restarted_H <= 1;
+		end
+		else if(CurrentState == ReadDataFromDramIntoCache) begin
+			FillAddress <= AddressBusInFrom68k;
+			Restarted_H <= 0;
+		end
+		else if((CurrentState == BurstFill | CurrentState == WriteFillLine | CurrentState == VictimSave | CurrentState == VictimRestore) && AS_L == 1'b1)
+			Restarted_H <= 1;
+	end
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Victim cache data: the data memory gives a word the clock after its address, so a line read out of the Cache is
+// stored one clock behind. LineTag shadows the tag memory so we know the address of the line being thrown out
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	always@(posedge Clock)
+	begin
+		if(TagCache_WE_L == 0)
+			LineTag[Index] <= TagDataOut;
+
+		if(CurrentState == CheckForCacheHit | CurrentState == PrefetchCheck) begin		// the clock before a fill or swap
+			EvictTag <= LineTag[Index];
+			EvictValid_H <= ValidBitIn_H;
+		end
+
+		if(VictimSwapGo_H == 1)
+			SwapWay <= VictimWay(DemandMatch_H);
+
+		// fill: new line into LineBuffer, old line into the next victim entry
+		if(CurrentState == BurstFill && SaveVictim_H == 1) begin
+			if(BurstCounter < 8)
+				LineBuffer[BurstCounter[2:0] + FillAddress[3:1]] <= DataBusInFromDram;
+			if(BurstCounter != 0)
+				VictimData[{VictimNext, BurstCounter[2:0] - 3'd1}] <= DataBusInFromCache;
+		end
+
+		// swap: Cache line into LineBuffer, then it takes the place of each victim word as that goes into the Cache
+		if(CurrentState == VictimSave && BurstCounter != 0)
+			LineBuffer[BurstCounter[2:0] - 3'd1] <= DataBusInFromCache;
+
+		if(CurrentState == VictimRestore && BurstCounter < 8)
+			VictimData[{SwapWay, BurstCounter[2:0]}] <= LineBuffer[BurstCounter[2:0]];
+
+		if(CurrentState == WriteFillLine && BurstCounter == 8)
+			VictimLine[VictimNext] <= EvictLine;
+		else if(CurrentState == VictimRestore && BurstCounter == 8)
+			VictimLine[SwapWay] <= EvictLine;
+
+		// write through updates a victim line like it does the Cache
+		if(CurrentState == WriteDataToDram && DemandMatch_H != 0) begin
+			if(UDS_L == 0)
+				VictimData[{VictimWay(DemandMatch_H), AddressBusInFrom68k[3:1]}][15:8] <= DataBusInFrom68k[15:8];
+			if(LDS_L == 0)
+				VictimData[{VictimWay(DemandMatch_H), AddressBusInFrom68k[3:1]}][7:0] <= DataBusInFrom68k[7:0];
+		end
+	end
+
+	always@(posedge Clock, negedge Reset_L)
+	begin
+		if(Reset_L == 0) begin
+			VictimValid_H <= 4'b0000;
+			VictimNext <= 0;
+		end
+		else if(CurrentState == WriteFillLine && BurstCounter == 8) begin		// fill done, old line is in the victim cache
+			VictimValid_H[VictimNext] <= 1;
+			VictimNext <= VictimNext + 1;
+		end
+		else if(CurrentState == VictimRestore && BurstCounter == 8)				// swap done, nothing to keep if the Cache line was invalid
+			VictimValid_H[SwapWay] <= EvictValid_H;
+	end
 	
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Prefetch streams and counters
+// a demand fill of line N points a stream at N+1 (the stream already expecting N, or StreamReplace's)
+// a demand read hit on a stream's prefetched line points it at the next one
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	always@(posedge Clock, negedge Reset_L)
+	begin
+		if(Reset_L == 0) begin
+			StreamLine[0] <= 0;
+			StreamLine[1] <= 0;
+			StreamPending_H <= 2'b00;
+			StreamFetched_H <= 2'b00;
+			StreamReplace <= 0;
+			PrefetchStream <= 0;
+			Prefetching_H <= 0;
+			PrefetchCount <= 0;
+			PrefetchHits <= 0;
+		end
+		else begin
+			if(CurrentState == Idle)
+				PrefetchStream <= ~StreamPending_H[0];				// stream 0 first
+
+			if(PrefetchGo_H == 1)
+				Prefetching_H <= 1;
+			else if(PrefetchEnd_H == 1)
+				Prefetching_H <= 0;
+
+			if(PrefetchFound_H == 1) begin
+				StreamPending_H[PrefetchStream] <= 0;
+				StreamFetched_H[PrefetchStream] <= 0;
+			end
+
+			if(CurrentState == CASDelay1 && Prefetching_H == 1) begin		// prefetch read is under way
+				StreamPending_H[PrefetchStream] <= 0;
+				StreamFetched_H[PrefetchStream] <= 1;
+				PrefetchCount <= PrefetchCount + 1;
+			end
+
+			if(Prefetch == 1 && CurrentState == CASDelay1 && Prefetching_H == 0 && FillAddress[26] == 0 && FillNextCacheable_H == 1) begin		// demand fill of a cached line
+				if(StreamLine[0] == FillAddress[31:4]) begin
+					StreamLine[0] <= FillNextLine;
+					StreamPending_H[0] <= 1;
+					StreamFetched_H[0] <= 0;
+				end
+				else if(StreamLine[1] == FillAddress[31:4]) begin
+					StreamLine[1] <= FillNextLine;
+					StreamPending_H[1] <= 1;
+					StreamFetched_H[1] <= 0;
+				end
+				else begin
+					StreamLine[StreamReplace] <= FillNextLine;
+					StreamPending_H[StreamReplace] <= 1;
+					StreamFetched_H[StreamReplace] <= 0;
+					StreamReplace <= ~StreamReplace;
+				end
+			end
+
+			if(CurrentState == WaitForEndOfCacheRead && AS_L == 0) begin		// demand read hit
+				if(StreamLine[0] == DemandLine && StreamPending_H[0] == 0) begin
+					StreamLine[0] <= DemandNextLine;
+					StreamPending_H[0] <= DemandNextCacheable_H;
+					StreamFetched_H[0] <= 0;
+					if(StreamFetched_H[0] == 1)
+						PrefetchHits <= PrefetchHits + 1;
+				end
+				else if(StreamLine[1] == DemandLine && StreamPending_H[1] == 0) begin
+					StreamLine[1] <= DemandNextLine;
+					StreamPending_H[1] <= DemandNextCacheable_H;
+					StreamFetched_H[1] <= 0;
+					if(StreamFetched_H[1] == 1)
+						PrefetchHits <= PrefetchHits + 1;
+				end
+			end
+		end
+	end
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // next state and output logic
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////	
@@ -113,14 +399,17 @@ module M68kCacheController_Verilog (
 		NextState 						<= Idle ;
 		DataBusOutTo68k 				<= DataBusInFromCache;
 		DataBusOutToDramController <= DataBusInFrom68k;
+		DataBusOutToCache				<= DataBusInFromDram;			// Cache is normally filled from the Dram
+		DataCacheUDS_L					<= 0;
+		DataCacheLDS_L					<= 0;
 
 		// default is to give the Dram the 68k's signals directly (unless we want to change something)	
 		
 		AddressBusOutToDramController[31:4]	<= AddressBusInFrom68k[31:4];
-		AddressBusOutToDramController[3:1]  <= 0;								// all reads to Dram have lower 3 address lines set to 0 for a Cache line regardless of 68k address
+		AddressBusOutToDramController[3:1]  <= AddressBusInFrom68k[3:1];	// line fills start at the 68k's word and wrap around the line
 		AddressBusOutToDramController[0] 	<= 0;								// to avoid inferring a latch for this bit
 		
-		TagDataOut						<= AddressBusInFrom68k[31:13];
+		TagDataOut						<= {AddressBusInFrom68k[31:27], 1'b0, AddressBusInFrom68k[25:13]};	// uncached alias has the same tag as the cached address
 		Index								<= AddressBusInFrom68k[12:4];			// cache index is 68ks address bits [12:4]
 		
 		UDS_DramController_L			<= UDS_L;
@@ -137,6 +426,10 @@ module M68kCacheController_Verilog (
 		WordAddress						<= 0;									// default is byte 0 in 8 byte Cache line	
 		
 		BurstCounterReset_L 			<= 1;									// default is that burst counter can run (and wrap around if needed), we'll control when to reset it		
+		PrefetchGo_H					<= 0;
+		PrefetchEnd_H					<= 0;
+		PrefetchFound_H				<= 0;
+		VictimSwapGo_H					<= 0;
 		NextState 						<= Idle ;							// default is to go to this state
 			
 //////////////////////////////////////////////////////////////////
@@ -172,20 +465,61 @@ module M68kCacheController_Verilog (
 ///////////////////////////////////////////////
 		else if(CurrentState == Idle) begin	  							// if we are in the idle state				
 			if(AS_L == 1'b0 & DramSelect68k_H == 1'b1) begin
-				if(WE_L == 1'b1) begin // if a read is requested
+				if(WE_L == 1'b1 & Uncached_H == 1'b1) begin // uncached read, go straight to the Dram without looking in the cache
 					UDS_DramController_L <= 1'b0; // activate UDS
 					LDS_DramController_L <= 1'b0; // activate LDS
-					NextState <= CheckForCacheHit;
+					DramSelectFromCache_L <= 1'b0; // get dram to perform the read
+					NextState <= ReadDataFromDramIntoCache;
 
-				end else begin // if a write is requested
-					if(ValidBitIn_H == 1'b1) begin
-						ValidBitOut_H <= 1'b0; // set to invalid
-						ValidBit_WE_L <= 1'b0; // perform the write to the valid memory in the cache
-					end
+				end else if(WE_L == 1'b1 & CacheHit_H == 1'b1 & ValidBitIn_H == 1'b1) begin // read hit, data and Dtack next clock
+					UDS_DramController_L <= 1'b0; // activate UDS
+					LDS_DramController_L <= 1'b0; // activate LDS
+					WordAddress <= AddressBusInFrom68k[3:1]; // give the cache the correct word address from 68k
+					NextState <= WaitForEndOfCacheRead;
 
+				end else if(WE_L == 1'b1) begin // if a read is requested
+					UDS_DramController_L <= 1'b0; // activate UDS
+					LDS_DramController_L <= 1'b0; // activate LDS
+					NextState <= CheckForCacheHit;
+
+				end else begin // if a write is requested, a hit is updated in WriteDataToDram and stays valid
 					DramSelectFromCache_L <= 1'b0; // start the DRAM controller to perform the write
 					NextState <= WriteDataToDram;
 				end
+
+			end else if(Prefetch == 1 & StreamPending_H != 2'b00) begin // 68k not using the Dram, prefetch
+				NextState <= PrefetchStart;
+			end
+		end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Prefetch: look up the line (one clock for the tag and valid memory to read it, one to check),
+// give up if the 68k wants the Dram, otherwise fill it like a demand miss with nobody waiting
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		else if(CurrentState == PrefetchStart | CurrentState == PrefetchCheck) begin
+			TagDataOut <= {PrefetchAddress[31:27], 1'b0, PrefetchAddress[25:13]};
+			Index <= PrefetchAddress[12:4];
+
+			if(AS_L == 1'b0 & DramSelect68k_H == 1'b1) begin // demand access, drop the prefetch for now
+				NextState <= Idle;
+
+			end else if(CurrentState == PrefetchStart) begin
+				NextState <= PrefetchCheck;
+
+			end else if((CacheHit_H == 1'b1 & ValidBitIn_H == 1'b1) | (VictimCache == 1 & PrefetchMatch_H != 4'b0000) | PrefetchCacheable_H == 1'b0) begin // already there, or not cacheable
+				PrefetchFound_H <= 1'b1;
+				NextState <= Idle;
+
+			end else begin
+				PrefetchGo_H <= 1'b1;
+				AddressBusOutToDramController <= PrefetchAddress;
+				AS_DramController_L <= 1'b0; // 68k's AS is not ours
+				UDS_DramController_L <= 1'b0; // activate
+				LDS_DramController_L <= 1'b0; // activate
+				WE_DramController_L <= 1'b1; // read
+				DramSelectFromCache_L <= 1'b0; // activate
+				NextState <= ReadDataFromDramIntoCache;
 			end
 		end
 
@@ -197,11 +531,21 @@ module M68kCacheController_Verilog (
 			UDS_DramController_L <= 1'b0; // keep activating UDS
 			LDS_DramController_L <= 1'b0; // keep activating LDS
 
-			if(CacheHit_H == 1'b1 & ValidBitIn_H == 1'b1) begin // had a cache hit
+			if(CacheHit_H == 1'b1 & ValidBitIn_H == 1'b1) begin // had a cache hit Idle did not see
 				WordAddress <= AddressBusInFrom68k[3:1]; // give the cache the correct word address from 68k
 				DtackTo68k_L <= 1'b0; // activate Dtack to 68k
 				NextState <= WaitForEndOfCacheRead;
 
+			end else if(VictimCache == 1 & DemandMatch_H != 4'b0000) begin // in the victim cache, swap it with the Cache line
+				VictimSwapGo_H <= 1'b1;
+				BurstCounterReset_L <= 1'b0;
+
+				if(ValidBitIn_H == 1'b1) begin
+					NextState <= VictimSave;
+				end else begin
+					NextState <= VictimRestore; // nothing worth keeping
+				end
+
 			end else begin // had a cache miss
 				DramSelectFromCache_L <= 1'b0; // get dram to perform the read
 				NextState <= ReadDataFromDramIntoCache;
@@ -240,10 +584,20 @@ module M68kCacheController_Verilog (
 			DramSelectFromCache_L <= 1'b0; // activate
 			DtackTo68k_L <= 1'b1; // deactivate
 
-			TagCache_WE_L <= 1'b0; // activate
+			if(Prefetching_H == 1'b1) begin // prefetch, the line comes from PrefetchAddress
+				TagDataOut <= {PrefetchAddress[31:27], 1'b0, PrefetchAddress[25:13]};
+				Index <= PrefetchAddress[12:4];
+				AddressBusOutToDramController <= PrefetchAddress;
+				AS_DramController_L <= 1'b0;
+				WE_DramController_L <= 1'b1;
+			end
 
-			ValidBitOut_H <= 1'b1; // activate
-			ValidBit_WE_L <= 1'b0; // activate
+			if(Uncached_H == 1'b0 | Prefetching_H == 1'b1) begin // don't allocate a line for an uncached read
+				TagCache_WE_L <= 1'b0; // activate
+
+				ValidBitOut_H <= 1'b1; // activate
+				ValidBit_WE_L <= 1'b0; // activate
+			end
 
 			UDS_DramController_L <= 1'b0; // activate
 			LDS_DramController_L <= 1'b0; // activate
@@ -256,10 +610,13 @@ module M68kCacheController_Verilog (
 		else if(CurrentState == CASDelay1) begin						// wait for Dram case signal to go low
 			UDS_DramController_L <= 1'b0; // activate
 			LDS_DramController_L <= 1'b0; // activate
+			if(Prefetching_H == 1'b1)
+				AS_DramController_L <= 1'b0; // keep the Dram (and any arbiter) ours during a prefetch
 
 			DramSelectFromCache_L <= 1'b0; // activate
 			DtackTo68k_L <= 1'b1; // deactivate
 
+			BurstCounterReset_L <= 1'b0; // count the rest of the CAS latency in CASDelay2
 			NextState <= CASDelay2;
 		end
 				
@@ -270,12 +627,18 @@ module M68kCacheController_Verilog (
 		else if(CurrentState == CASDelay2) begin						// wait for Dram case signal to go low
 			UDS_DramController_L <= 1'b0; // activate
 			LDS_DramController_L <= 1'b0; // activate
+			if(Prefetching_H == 1'b1)
+				AS_DramController_L <= 1'b0; // keep the Dram (and any arbiter) ours during a prefetch
 
 			DramSelectFromCache_L <= 1'b0; // activate
 			DtackTo68k_L <= 1'b1; // deactivate
 
-			BurstCounterReset_L <= 1'b0; // activate
-			NextState <= BurstFill;
+			if(BurstCounter >= CASLatency - 2) begin // latency used up, data arrives next clock
+				BurstCounterReset_L <= 1'b0; // activate
+				NextState <= BurstFill;
+			end else begin
+				NextState <= CASDelay2;
+			end
 		end
 
 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -285,38 +648,143 @@ module M68kCacheController_Verilog (
 		else if(CurrentState == BurstFill) begin						// wait for Dram case signal to go low
 			UDS_DramController_L <= 1'b0; // activate
 			LDS_DramController_L <= 1'b0; // activate
+			if(Prefetching_H == 1'b1)
+				AS_DramController_L <= 1'b0; // keep the Dram (and any arbiter) ours during a prefetch
 
 			DramSelectFromCache_L <= 1'b0; // activate
 			DtackTo68k_L <= 1'b1; // deactivate
 
+			Index <= FillAddress[12:4];
+
 			if(BurstCounter == 16'd8) begin // read 8 words, then stop
+				if(SaveVictim_H == 1'b1) begin
+					BurstCounterReset_L <= 1'b0;
+					NextState <= WriteFillLine;
+				end else begin
+					NextState <= EndBurstFill;
+				end
+
+			end else if(SaveVictim_H == 1'b1) begin // read the old line out for the victim cache, new one goes to LineBuffer
+				WordAddress <= BurstCounter[2:0];
+				NextState <= BurstFill;
+
+			end else begin
+				WordAddress <= BurstCounter[2:0] + FillAddress[3:1]; // burst wraps around the line from the 68k's word
+				DataCache_WE_L <= FillAddress[26]; // activate, unless uncached
+				NextState <= BurstFill;
+			end
+
+			if(BurstCounter != 0 & Restarted_H == 1'b0 & AS_L == 1'b0) begin // 68k's word is in, let it carry on
+				DtackTo68k_L <= 1'b0;
+				DataBusOutTo68k <= CriticalWord;
+			end
+		end
+			
+///////////////////////////////////////////////////////////////////////////////////////
+// Write the line held in LineBuffer into the Cache. The burst is over, so the Dram
+// controller's cycle is ended here (as EndBurstFill does) and it can refresh meanwhile
+///////////////////////////////////////////////////////////////////////////////////////
+
+		else if(CurrentState == WriteFillLine) begin
+			UDS_DramController_L <= 1'b1; // deactivate
+			LDS_DramController_L <= 1'b1; // deactivate
+			DramSelectFromCache_L <= 1'b1; // deactivate
+
+			Index <= FillAddress[12:4];
+
+			if(BurstCounter == 16'd8) begin
 				NextState <= EndBurstFill;
 
 			end else begin
 				WordAddress <= BurstCounter[2:0];
+				DataBusOutToCache <= LineBuffer[BurstCounter[2:0]];
 				DataCache_WE_L <= 1'b0; // activate
-				NextState <= BurstFill;
+				NextState <= WriteFillLine;
+			end
+
+			if(Restarted_H == 1'b0 & AS_L == 1'b0) begin
+				DtackTo68k_L <= 1'b0;
+				DataBusOutTo68k <= CriticalWord;
 			end
 		end
-			
+
+///////////////////////////////////////////////////////////////////////////////////////
+// Victim hit: read the Cache line out into LineBuffer (VictimSave), then write the
+// victim line into the Cache in its place (VictimRestore). The 68k already has its word
+///////////////////////////////////////////////////////////////////////////////////////
+
+		else if(CurrentState == VictimSave) begin
+			Index <= FillAddress[12:4];
+			WordAddress <= BurstCounter[2:0];
+
+			if(BurstCounter == 16'd8) begin
+				BurstCounterReset_L <= 1'b0;
+				NextState <= VictimRestore;
+			end else begin
+				NextState <= VictimSave;
+			end
+
+			if(Restarted_H == 1'b0 & AS_L == 1'b0) begin
+				DtackTo68k_L <= 1'b0;
+				DataBusOutTo68k <= CriticalWord;
+			end
+		end
+
+		else if(CurrentState == VictimRestore) begin
+			Index <= FillAddress[12:4];
+			TagDataOut <= {FillAddress[31:27], 1'b0, FillAddress[25:13]};
+
+			if(BurstCounter == 16'd8) begin
+				NextState <= EndBurstFill;
+
+			end else begin
+				WordAddress <= BurstCounter[2:0];
+				DataBusOutToCache <= VictimData[{SwapWay, BurstCounter[2:0]}];
+				DataCache_WE_L <= 1'b0; // activate
+
+				TagCache_WE_L <= 1'b0; // activate
+				ValidBitOut_H <= 1'b1; // activate
+				ValidBit_WE_L <= 1'b0; // activate
+				NextState <= VictimRestore;
+			end
+
+			if(Restarted_H == 1'b0 & AS_L == 1'b0) begin
+				DtackTo68k_L <= 1'b0;
+				DataBusOutTo68k <= CriticalWord;
+			end
+		end
+
 ///////////////////////////////////////////////////////////////////////////////////////
 // End Burst fill
 ///////////////////////////////////////////////////////////////////////////////////////
 		else if(CurrentState == EndBurstFill) begin							// wait for Dram case signal to go low
 			DramSelectFromCache_L <= 1'b1; // deactivate
-			DtackTo68k_L <= 1'b0; // activate
 
-			UDS_DramController_L <= 1'b0; // activate
-			LDS_DramController_L <= 1'b0; // activate
-
-			WordAddress <= AddressBusInFrom68k[3:1];
-			DataBusOutTo68k <= DataBusInFromCache; // get data from cache and give to CPU
+			if(Restarted_H == 1'b1) begin // 68k has already gone (or prefetch), end the Dram controller's cycle before the next access
+				UDS_DramController_L <= 1'b1; // deactivate
+				LDS_DramController_L <= 1'b1; // deactivate
 
-			if(AS_L == 1'b1 | DramSelect68k_H == 1'b0) begin
-				NextState <= Idle;
+				if(DtackFromDram_L == 1'b1) begin
+					PrefetchEnd_H <= 1'b1;
+					NextState <= Idle;
+				end else begin
+					NextState <= EndBurstFill;
+				end
 
 			end else begin
-				NextState <= EndBurstFill;
+				DtackTo68k_L <= 1'b0; // activate
+
+				UDS_DramController_L <= 1'b0; // activate
+				LDS_DramController_L <= 1'b0; // activate
+
+				DataBusOutTo68k <= CriticalWord; // give the word caught during the burst to the CPU
+
+				if(AS_L == 1'b1 | DramSelect68k_H == 1'b0) begin
+					NextState <= Idle;
+
+				end else begin
+					NextState <= EndBurstFill;
+				end
 			end
 		end
 
@@ -329,6 +797,14 @@ module M68kCacheController_Verilog (
 			DramSelectFromCache_L <= 1'b0; // activate
 			DtackTo68k_L <= DtackFromDram_L;
 
+			if(CacheHit_H == 1'b1 & ValidBitIn_H == 1'b1 & (UDS_L == 1'b0 | LDS_L == 1'b0)) begin // write hit, update the cached word too
+				WordAddress <= AddressBusInFrom68k[3:1];
+				DataBusOutToCache <= DataBusInFrom68k;
+				DataCacheUDS_L <= UDS_L;
+				DataCacheLDS_L <= LDS_L;
+				DataCache_WE_L <= 1'b0;
+			end
+
 			if(AS_L == 1'b1 | DramSelect68k_H == 1'b0) begin
 				NextState <= Idle;
 
@@ -1,6 +1,34 @@
 ---------------------------------------------------------------------------------------
--- Simple DRAM controller for the DE1_SoC board. Assumes Clock of 90Mhz for timing
--- or 11.1ns per clock
+-- Simple DRAM controller for the DE1_SoC board. Clock defaults to 90Mhz (11.1ns per clock)
+--
+-- SDRAM timings are generics in ns, the clock counts for each one are worked out from
+-- ClockFrequencyMHz when the design is compiled, so the controller can be rebuilt for a
+-- different clock by changing the generics only. CASLatency (2 or 3) is programmed into
+-- the mode register, the cache controller's CASLatency parameter has to match it
+--
+-- BankMapping generic selects how the 68k address is split into bank/row/column
+-- (column is always Address(10 downto 1))
+--		0 = linear:       bank = Address(25 downto 24), row = Address(23 downto 11)
+--		1 = interleaved:  bank = Address(12 downto 11), row = Address(25 downto 13)
+--		2 = XOR hashed:   bank = Address(25 downto 24) xor Address(12 downto 11), row = Address(23 downto 11)
+--
+-- Up to 4 masters can share the controller through DramArbiter.vhd, which sits between them
+-- and the controller's 68k bus signals
+--
+-- Byte writes use the SDRAM's DQM byte masks: SDram_DQM(1) (UDQM) masks data bits 15-8 and SDram_DQM(0)
+-- (LDQM) masks bits 7-0 during a write, so a byte store is one write command that leaves the other byte alone
+--
+-- Bulk transfer port: moves up to a whole row (1024 words) per activate using a full page burst.
+-- The master holds BulkRequest_H, BulkWrite_H, BulkAddress and BulkLength (words, 1-1024) until the
+-- rising edge where BulkDone_H is high, and the transfer must not run past the end of the row (the
+-- burst wraps to column 0).
+--		write: BulkDataIn is written in each clock BulkTake_H is high, then the master presents the next word
+--		read:  SDram_DQ holds the next word at each rising edge where BulkDataValid_H is high
+-- BulkReady_H low pauses the transfer with a BurstStop. For reads, up to CASLatency + 1 words
+-- already requested still arrive after BulkReady_H goes low.
+-- The mode register is switched to full page bursts for the transfer and back afterwards. A 68k
+-- access or refresh pauses the transfer (burst stopped, bank precharged, mode restored), and it
+-- carries on from where it left off once the 68k has finished
 --
 -- Copyright PJ Davies June 2017
 ---------------------------------------------------------------------------------------
@@ -13,6 +41,18 @@ USE ieee.std_logic_arith.all;
 
 
 entity CacheEnabledDramController is
+	Generic (
+		BankMapping				: integer := 0;							-- 0 = linear, 1 = interleaved, 2 = XOR hashed (see above)
+		ClockFrequencyMHz		: integer := 90;							-- controller/SDRAM clock
+		CASLatency				: integer := 2;							-- clocks from read command to first data, 2 or 3
+		tPowerUp_ns				: integer := 100000;						-- power up delay before the first command
+		tRP_ns					: integer := 30;							-- precharge to activate/refresh (18ns min, margin for skew)
+		tRCD_ns					: integer := 30;							-- activate to read/write (18ns min, margin for skew)
+		tRFC_ns					: integer := 70;							-- refresh to next command (60ns min)
+		tREFI_ns					: integer := 7500;						-- interval between refreshes (64ms / 8192 rows = 7.8us max)
+		tRAS_ns					: integer := 42;							-- activate to precharge
+		tWR_ns					: integer := 15							-- last write data to precharge
+	);
 	Port (
 		Clock	 			: in std_logic ;									-- used to drive the state machine- stat changes occur on positive edge
 		Reset_L    		: in std_logic ;     							-- active low reset 
@@ -33,11 +73,61 @@ entity CacheEnabledDramController is
 		SDram_BA   		: out std_logic_vector(1 downto 0) ;		-- 2 bit bank address
 		SDram_DQ   		: inout std_logic_vector(15 downto 0);  	-- 16 bit bi-directional data lines to dram chip
 		Dtack_L			: out std_logic ;									-- Dtack back to CPU at end of bus cycle
-		ResetOut_L		: out std_logic 									-- reset out to the CPU
+		ResetOut_L		: out std_logic ;									-- reset out to the CPU
+
+		-- bulk transfer port (see above), inputs default to idle so the port can be left off a symbol
+		BulkRequest_H	: in std_logic := '0';								-- transfer wanted, held until BulkDone_H
+		BulkWrite_H		: in std_logic := '0';								-- '1' = write to the SDRAM, '0' = read
+		BulkAddress		: in std_logic_vector(31 downto 0) := (others => '0');	-- address of the first word
+		BulkLength		: in std_logic_vector(10 downto 0) := (others => '0');	-- number of words, 1 to 1024
+		BulkDataIn		: in std_logic_vector(15 downto 0) := (others => '0');	-- write data
+		BulkReady_H		: in std_logic := '0';								-- master can take/give another word
+		BulkTake_H		: out std_logic;									-- BulkDataIn is written this clock
+		BulkDataValid_H	: out std_logic;								-- read word is on SDram_DQ at this rising edge
+		BulkDone_H		: out std_logic;									-- transfer finished
+
+		SDram_DQM		: out std_logic_vector(1 downto 0)			-- byte masks to the dram chip, bit 1 = upper byte, '1' masks the byte during a write
 	);
 end ;
 
 architecture bhvr of CacheEnabledDramController is
+	-- convert a time in ns to a whole number of clocks, rounding up
+
+	function NsToClocks(ns : integer) return integer is
+	begin
+		return (ns * ClockFrequencyMHz + 999) / 1000 ;
+	end function ;
+
+	function Maximum(a : integer ; b : integer) return integer is
+	begin
+		if(a > b) then
+			return a ;
+		end if ;
+		return b ;
+	end function ;
+
+	constant PowerUpClocks			: integer := NsToClocks(tPowerUp_ns) ;
+	constant TrpClocks				: integer := NsToClocks(tRP_ns) ;
+	constant TrcdClocks				: integer := NsToClocks(tRCD_ns) ;
+	constant TrfcClocks				: integer := NsToClocks(tRFC_ns) ;
+	constant TrasClocks				: integer := NsToClocks(tRAS_ns) ;
+	constant TwrClocks				: integer := NsToClocks(tWR_ns) ;
+	constant RefreshClocks			: integer := (tREFI_ns * ClockFrequencyMHz) / 1000 ;			-- round down so we refresh early rather than late
+
+	-- state timer values for the waits below, each wait state is left once the state timer reaches 0
+
+	constant TrpWait					: integer := Maximum(TrpClocks - 2, 0) ;						-- precharge, wait state(s), then refresh
+	constant TrcdWait					: integer := Maximum(TrcdClocks - 2, 0) ;						-- activate, wait state(s), then read
+	constant TrcdWriteWait			: integer := Maximum(TrcdClocks - 1, 0) ;						-- activate, then write from the wait state itself
+	constant TrfcWait					: integer := Maximum(TrfcClocks - 2, 0) ;						-- refresh, wait state(s), idle, then next command
+	constant InitRefreshLoop		: integer := TrfcClocks + 2 ;										-- clocks per initial auto refresh
+	constant BulkStopWait			: integer := Maximum(TwrClocks, TrasClocks) ;				-- burst stopped, wait state(s), then precharge
+
+	-- mode register A12 - A0: write burst mode, cas latency, sequential access, read burst length
+
+	constant CacheModeWord			: std_logic_vector(12 downto 0) := b"000_1_00" & conv_std_logic_vector(CASLatency, 3) & b"0_011" ;	-- single writes, burst of 8 reads
+	constant BulkModeWord			: std_logic_vector(12 downto 0) := b"000_0_00" & conv_std_logic_vector(CASLatency, 3) & b"0_111" ;	-- full page burst reads and writes
+
 	-- command constants for the Dram chip (combinations of signals)
 	
 	-- CKE, CS, Ras, Cas, Write
@@ -78,12 +168,30 @@ architecture bhvr of CacheEnabledDramController is
 	Signal  	RefreshTimerDone_H 	: std_logic ;												-- set to 1 when refresh timer reaches 0
 
 	Signal  	BankAddress 			: std_logic_vector(1 downto 0) ;
+	Signal  	MappedBank 				: std_logic_vector(1 downto 0) ;						-- bank and row for the 68k address after BankMapping
+	Signal  	MappedRow 				: std_logic_vector(12 downto 0) ;
 	Signal  	DramAddress 			: std_logic_vector(12 downto 0) ;
 
 	Signal  	SDramWriteData			: std_logic_vector(15 downto 0) ;
+	Signal  	DramDQM					: std_logic_vector(1 downto 0) ;						-- byte masks to go out with the command
 	Signal  	FPGAWritingtoSDram_H	: std_logic ;												-- When '1' enables FPGA data out lines leading to SDRAM to allow writing, otherwise they are set to Tri-State "Z"
 	Signal  	CPU_Dtack_L  			: std_logic ;												-- Dtack back to CPU
 	Signal  	CPUReset_L				: std_logic ;
+
+	-- bulk transfer port
+	Signal  	BulkBank 				: std_logic_vector(1 downto 0) ;						-- bank, row and column of the next bulk word
+	Signal  	BulkRow 					: std_logic_vector(12 downto 0) ;
+	Signal  	BulkColumn 				: std_logic_vector(9 downto 0) ;
+	Signal  	BulkCount 				: std_logic_vector(10 downto 0) ;					-- words moved (or requested for reads) so far
+	Signal  	BulkInProgress_H		: std_logic ;												-- a transfer has been started, possibly paused
+	Signal  	BulkRunning_H			: std_logic ;												-- a full page burst is under way
+	Signal  	BulkValidPipe			: std_logic_vector(3 downto 0) ;						-- words requested in the last 4 clocks, for CAS latency
+	Signal  	BulkStart_H				: std_logic ;												-- new transfer, clear the count
+	Signal  	BulkWord_H				: std_logic ;												-- one more word this clock
+	Signal  	BulkBurstOn_H			: std_logic ;												-- read/write command issued, burst running
+	Signal  	BulkBurstOff_H			: std_logic ;												-- burst stopped
+	Signal  	BulkFinish_H			: std_logic ;												-- transfer complete
+	Signal  	CpuRequest_H			: std_logic ;												-- 68k wants the SDRAM, bulk transfer has to pause
 	
 	-- Dram controller states after power on and/or reset
 	-- most dram chip data sheets imply only 2 auto refresh commands need be issued due power up, but
@@ -97,7 +205,6 @@ architecture bhvr of CacheEnabledDramController is
 	constant IssueFirstNOP						: std_logic_vector(5 downto 0) := "000010" ;			-- issuing 1st NOP after power up
 	constant PrechargingAllBanks				: std_logic_vector(5 downto 0) := "000011" ;			-- issuing precharge all command after power up
 	constant PreChargeNOP1						: std_logic_vector(5 downto 0) := "000100" ;			-- issuing precharge all command after power up
-	constant PreChargeNOP2						: std_logic_vector(5 downto 0) := "000101" ;	
 	constant PreChargeNOP3						: std_logic_vector(5 downto 0) := "000110" ;	
 	constant InitialAutoRefreshSequence		: std_logic_vector(5 downto 0) := "000111" ;			-- issuing first auto refresh command after power up
 	constant RefreshWait1						: std_logic_vector(5 downto 0) := "001000" ;			-- 1 clock period delay before second auto refresh
@@ -110,7 +217,6 @@ architecture bhvr of CacheEnabledDramController is
 -------------------------------------------------------------------------------------------------------------------------------------------------	
 	constant DoAutoRefresh						: std_logic_vector(5 downto 0) := "001101" ;
 	constant PrechargeRefreshWait1			: std_logic_vector(5 downto 0) := "001110" ;
-	constant PrechargeRefreshWait2			: std_logic_vector(5 downto 0) := "001111" ;
 	constant RefreshDram							: std_logic_vector(5 downto 0) := "010000" ;
 	constant RefreshDramWait1					: std_logic_vector(5 downto 0) := "010001" ;
 
@@ -119,7 +225,6 @@ architecture bhvr of CacheEnabledDramController is
 -------------------------------------------------------------------------------------------------------------------------------------------------		
 	constant IssueRAS								: std_logic_vector(5 downto 0) := "010010" ;
 	constant IssueCASWait1						: std_logic_vector(5 downto 0) := "010011" ;
-	constant IssueCASWait2						: std_logic_vector(5 downto 0) := "010100" ;
 	constant IssueCASWait3						: std_logic_vector(5 downto 0) := "010101" ;
 	constant WaitForDataStrobes				: std_logic_vector(5 downto 0) := "010110" ;
 	
@@ -137,8 +242,81 @@ architecture bhvr of CacheEnabledDramController is
 	
 	constant WaitTimeTrp							: std_logic_vector(5 downto 0) := "011011" ;
 	constant Acknowledge							: std_logic_vector(5 downto 0) := "011100" ;
+
+-------------------------------------------------------------------------------------------------------------------------------------------------
+-- Bulk transfer States
+-------------------------------------------------------------------------------------------------------------------------------------------------
+	constant BulkStart							: std_logic_vector(5 downto 0) := "011101" ;			-- let the last 68k access's auto precharge finish
+	constant BulkModeRegister					: std_logic_vector(5 downto 0) := "011110" ;			-- switch to full page bursts
+	constant BulkModeRegisterNOP				: std_logic_vector(5 downto 0) := "011111" ;
+	constant BulkActivate						: std_logic_vector(5 downto 0) := "100000" ;
+	constant BulkReadBurst						: std_logic_vector(5 downto 0) := "100001" ;			-- one word requested per clock while the master is ready
+	constant BulkWriteBurst						: std_logic_vector(5 downto 0) := "100010" ;			-- one word written per clock while the master is ready
+	constant BulkStopped							: std_logic_vector(5 downto 0) := "100011" ;			-- read words still arriving, tWR/tRAS before precharge
+	constant BulkPrecharge						: std_logic_vector(5 downto 0) := "100100" ;
+	constant BulkPrechargeWait					: std_logic_vector(5 downto 0) := "100101" ;
+	constant BulkRestoreModeRegister			: std_logic_vector(5 downto 0) := "100110" ;			-- back to cache line bursts
+	constant BulkRestoreNOP						: std_logic_vector(5 downto 0) := "100111" ;
 	
 Begin
+
+---------------------------------------------------------------------------------------------------------------------
+-- split the 68k address into bank and row according to the BankMapping generic
+---------------------------------------------------------------------------------------------------------------------
+
+	MappedBank	<= Address(12 downto 11) when BankMapping = 1 else
+						Address(25 downto 24) xor Address(12 downto 11) when BankMapping = 2 else
+						Address(25 downto 24) ;
+
+	MappedRow	<= Address(25 downto 13) when BankMapping = 1 else
+						Address(23 downto 11) ;
+
+	BulkBank		<= BulkAddress(12 downto 11) when BankMapping = 1 else
+						BulkAddress(25 downto 24) xor BulkAddress(12 downto 11) when BankMapping = 2 else
+						BulkAddress(25 downto 24) ;
+
+	BulkRow		<= BulkAddress(25 downto 13) when BankMapping = 1 else
+						BulkAddress(23 downto 11) ;
+
+	BulkColumn	<= BulkAddress(10 downto 1) + BulkCount(9 downto 0) ;
+
+	CpuRequest_H	<= not (DramSelect_L or AS_L) ;
+	BulkDataValid_H <= BulkValidPipe(CASLatency) ;
+
+---------------------------------------------------------------------------------------------------------------------
+-- Bulk transfer progress: word count, whether a burst is running, and a shift register so read words are flagged
+-- CASLatency + 1 clocks after they were requested (command register clock + CAS latency)
+---------------------------------------------------------------------------------------------------------------------
+
+	process(Clock, Reset_L)
+	begin
+		if(Reset_L = '0') then
+			BulkCount 			<= (others => '0') ;
+			BulkInProgress_H	<= '0' ;
+			BulkRunning_H		<= '0' ;
+			BulkValidPipe		<= "0000" ;
+
+		elsif(rising_edge(Clock)) then
+			BulkValidPipe <= BulkValidPipe(2 downto 0) & (BulkWord_H and not BulkWrite_H) ;
+
+			if(BulkStart_H = '1') then
+				BulkCount 			<= (others => '0') ;
+				BulkInProgress_H	<= '1' ;
+			elsif(BulkWord_H = '1') then
+				BulkCount			<= BulkCount + 1 ;
+			end if ;
+
+			if(BulkFinish_H = '1') then
+				BulkInProgress_H	<= '0' ;
+			end if ;
+
+			if(BulkBurstOn_H = '1') then
+				BulkRunning_H		<= '1' ;
+			elsif(BulkBurstOff_H = '1') then
+				BulkRunning_H		<= '0' ;
+			end if ;
+		end if ;
+	end process ;
 	
 ----------------------------------------------------------------------------------------------------------------------------------------------------------
 -- General Timer for timing and counting things: Loadable and counts down on each clock then produced a TimerDone signal and stops counting
@@ -220,6 +398,7 @@ Begin
 			SDram_WE_L 		 	<= Command(0);
 			SDram_Addr  		<= DramAddress;
 			SDram_BA   			<= BankAddress;
+			SDram_DQM			<= DramDQM;
 	
 			Dtack_L 				<= CPU_Dtack_L ;
 			ResetOut_L 			<= CPUReset_L ;
@@ -236,7 +415,8 @@ Begin
 -- Next state and output logic
 ----------------------------------------------------------------------------------------------------------------------	
 	
-	process(Clock, Reset_L, Address, DataIn, AS_L, UDS_L, LDS_L, DramSelect_L, WE_L, CurrentState, TimerDone_H, RefreshTimerDone_H, Timer, StateTimerDone_H)
+	process(Clock, Reset_L, Address, DataIn, AS_L, UDS_L, LDS_L, DramSelect_L, WE_L, CurrentState, TimerDone_H, RefreshTimerDone_H, Timer, StateTimerDone_H, MappedBank, MappedRow,
+			  CpuRequest_H, BulkRequest_H, BulkWrite_H, BulkLength, BulkDataIn, BulkReady_H, BulkBank, BulkRow, BulkColumn, BulkCount, BulkInProgress_H, BulkRunning_H, BulkValidPipe)
 	begin
 	-- start with default values for everything and override as necessary, so we do not infer storage for signals inside this process
 	
@@ -256,11 +436,20 @@ Begin
 
 		CPU_Dtack_L 				<= '1' ;							-- acknowledged
 		SDramWriteData 			<= "0000000000000000" ;
+		DramDQM						<= "00" ;						-- both bytes enabled
 		CPUReset_L 					<= '0' ;							-- default is reset to CPU
 		FPGAWritingtoSDram_H 	<= '0' ;							-- default is to tri-state the FPGA data lines leading to bi-directional SDRam data lines, i.e. assume a read operation
 
+		BulkTake_H					<= '0' ;							-- bulk transfer unchanged
+		BulkDone_H					<= '0' ;
+		BulkStart_H					<= '0' ;
+		BulkWord_H					<= '0' ;
+		BulkBurstOn_H				<= '0' ;
+		BulkBurstOff_H				<= '0' ;
+		BulkFinish_H				<= '0' ;
+
 		if(CurrentState = InitialisingState ) then
-			TimerValue 				<= "0000000000001000";					-- decimal 5000 = 1 0011 1000 1000 equivalent to a value of 100us at 50Mhz clock
+			TimerValue 				<= conv_std_logic_vector(PowerUpClocks, 16) ;		-- power up delay (100us)
 			TimerLoad_H 			<= '1' ;										-- on next edge of clock timer will be loaded and start to time out
 			Command 					<= PoweringUp ;							-- clock enable must be low (disabled)
 			NextState 				<= WaitingForPowerUpState ;			-- on next edge move to this state
@@ -285,32 +474,34 @@ Begin
 		elsif(CurrentState = PrechargingAllBanks) then	  				-- issue a precharge to all banks
 			Command 					<= PrechargeAllBanks ;
 			DRamAddress 			<= "0010000000000" ;						-- A10 has to be logic 1 to precharge all banks
+			StateTimerLoad_H		<= '1';
+			StateTimerValue		<= conv_std_logic_vector(TrpWait, 4) ;
 			NextState 				<= PreChargeNOP1 ;						-- make sure 1 NOP after prechargeallbanks before first refresh	
 			
--- have to wait at least 18ns after precharge before issuing an autorefresh command. At 11.1ns per clock this means at least 2 clocks, but let's make it 3
+-- have to wait at least tRP after precharge before issuing an autorefresh command, NOP1 waits for the state timer, NOP3 adds one more for margin
 	
-		elsif(CurrentState = PreChargeNOP1) then	  						-- issue 3 NOPs after precharge before 1st autorefresh
+		elsif(CurrentState = PreChargeNOP1) then	  						-- issue NOPs after precharge before 1st autorefresh
 			Command 					<= NOP ;
-			NextState 				<= PreChargeNOP2 ;						
+			NextState 				<= PreChargeNOP1 ;
 			
-		elsif(CurrentState = PreChargeNOP2) then
-			Command 					<= NOP ;
-			NextState 				<= PreChargeNOP3 ;
+			if(StateTimerDone_H = '1') then
+				NextState 			<= PreChargeNOP3 ;
+			end if ;
 
 		elsif(CurrentState = PreChargeNOP3) then	  						
 			Command 					<= NOP ;
-			TimerValue 				<= X"0044";									-- Load timer with deimal 68 which means initial autorefresh sequence will issue 8 auto refreshes of 8 states
+			TimerValue 				<= conv_std_logic_vector(8 * InitRefreshLoop - 4, 16) ;	-- initial autorefresh sequence will issue 8 auto refreshes
 			TimerLoad_H 			<= '1' ;										-- on next edge of clock timer will be loaded and start to time out
 			NextState 				<= InitialAutoRefreshSequence ;		-- Now issue 1st refresh
 						
--- start of a loop using the timer where we generate 8 autorefresh commands to the SDRAM during power on/reset with 8 NOP time delays between each one
--- The chip on the DE1 states that it requries at least 2 autorefreshes (but some chips need 8), so that's at least > 68 clocks at 8 by 8 clocks per autorefresh
+-- start of a loop using the timer where we generate 8 autorefresh commands to the SDRAM during power on/reset with tRFC worth of NOPs between each one
+-- The chip on the DE1 states that it requries at least 2 autorefreshes (but some chips need 8)
 			
 		elsif(CurrentState = InitialAutoRefreshSequence) then	  		-- issue an autorefresh command
 			Command 					<= AutoRefresh ;
 			NextState 				<= RefreshWait1 ;
 			StateTimerLoad_H		<= '1';
-			StateTimerValue		<= b"0110" ;								-- 6 for a total of 8 NOPs between refreshes
+			StateTimerValue		<= conv_std_logic_vector(TrfcClocks - 1, 4) ;		-- TrfcClocks + 1 NOPs between refreshes
 		
 		elsif(CurrentState = RefreshWait1) then	  						-- State Timer loaded here and decrements on each risging edge of clock
 			Command 					<= NOP ;
@@ -335,14 +526,13 @@ Begin
 		elsif(CurrentState = LoadModeRegister) then	  						-- load sdram mode register
 			Command 					<= ModeRegisterSet ;
 			
-			DramAddress 			<= b"000_1_00_010_0_011"	;				-- 13 bits of address A12 - A0: Write burst=1, read burst=8, sequential access, cas latency=2
+			DramAddress 			<= CacheModeWord ;							-- 13 bits of address A12 - A0: Write burst=1, cas latency, sequential access, read burst=8
 			BankAddress 			<= "00"	;
 			NextState 				<= LoadModeRegisterWait1NOP ;
 
 		elsif(CurrentState = LoadModeRegisterWait1NOP) then	  				
 			Command 					<= NOP ;
---			RefreshTimerValue 	<= b"0000_0001_0101_0010";					-- 7.5us delay for refreshing = 338 clocks at 20.0ns per clock (50 Mhz)
-			RefreshTimerValue 	<= b"0000_0010_1010_0011";					-- 7.5us delay for refreshing = 675 clocks at 11.1ns per clock (90 Mhz)
+			RefreshTimerValue 	<= conv_std_logic_vector(RefreshClocks, 16) ;		-- tREFI delay for refreshing (675 clocks at 90Mhz)
 			RefreshTimerLoad_H 	<= '1' ;											-- preload and start refresh timer
 			NextState 				<= IDLE ;			
 						
@@ -354,24 +544,24 @@ Begin
 			Command 					<= PrechargeAllBanks ;
 			CPUReset_L 				<= '1' ;
 			DRamAddress 			<= "0010000000000" ;							-- A10 has to be logic 1 to precharge all banks
---			RefreshTimerValue 	<= b"0000_0001_0101_0010";					-- 7.5us delay for refreshing = 338 clocks at 20.0ns per clock (50 Mhz)
-			RefreshTimerValue 	<= b"0000_0010_1010_0011";					-- 7.5us delay for refreshing = 675 clocks at 11.1ns per clock (90 Mhz)
+			RefreshTimerValue 	<= conv_std_logic_vector(RefreshClocks, 16) ;		-- tREFI delay for refreshing (675 clocks at 90Mhz)
 			RefreshTimerLoad_H 	<= '1' ;											-- preload and start refresh timer
-			NextState 				<= PrechargeRefreshWait1	 ;				-- wait 1 clock after prechage before issuing refresh command
+			StateTimerLoad_H		<= '1';
+			StateTimerValue		<= conv_std_logic_vector(TrpWait, 4) ;
+			NextState 				<= PrechargeRefreshWait1	 ;				-- wait after prechage before issuing refresh command
 
 ------------------------------------------------------------------------------------------------------------------------------------
--- Wait 3 clocks after after pre-charge command before issuing Refresh command. minimum is 18ns with 3 clock @ 90 Mhz this gives 33ns
+-- Wait tRP after pre-charge command before issuing Refresh command. minimum is 18ns, the default 30ns gives 3 clocks @ 90 Mhz or 33ns
 ------------------------------------------------------------------------------------------------------------------------------------
 			
-		elsif(CurrentState = PrechargeRefreshWait1) then	  				
+		elsif(CurrentState = PrechargeRefreshWait1) then	  				-- state timer loaded with value here and decrements with each rising egde of clock
 			Command 					<= NOP ;
 			CPUReset_L 				<= '1' ;	
-			NextState 				<= PrechargeRefreshWait2 ;	
+			NextState 				<= PrechargeRefreshWait1 ;	
 			
-		elsif(CurrentState = PrechargeRefreshWait2) then	  				
-			Command 					<= NOP ;
-			CPUReset_L 				<= '1' ;	
-			NextState 				<= RefreshDram ;
+			if(StateTimerDone_H = '1') then
+				NextState 			<= RefreshDram ;
+			end if ;
 
 		elsif(CurrentState = RefreshDram) then	  								-- issue auto-refresh command to dram 3 clock after precharge all bbanks command
 			Command 					<= AutoRefresh ;
@@ -379,10 +569,10 @@ Begin
 			NextState 				<= RefreshDramWait1 ;
 
 			StateTimerLoad_H		<= '1';
-			StateTimerValue		<= b"0101";										-- 5 for delay of 7 NOPs
+			StateTimerValue		<= conv_std_logic_vector(TrfcWait, 4) ;		-- tRFC worth of NOPs (7 at 90Mhz)
 
 ----------------------------------------------------------------------------------------------------------------------------------
--- Wait at least 60ns after Auto-refresh command before returning to idle state, i.e. 7 NOP's at 90Mhz = 11.1 ns per clock
+-- Wait at least tRFC after Auto-refresh command before returning to idle state, i.e. 7 NOP's at 90Mhz = 11.1 ns per clock
 ----------------------------------------------------------------------------------------------------------------------------------
 
 		elsif(CurrentState = RefreshDramWait1) then				-- state timer loaded with value here and decrements with each rising egde of clock
@@ -407,14 +597,23 @@ Begin
 			
 			elsif (DramSelect_L = '0' and AS_L = '0') then			-- if 68000 trying to access the dram not sure if it is read or write at the moment
 				Command 				<= BankActivate;						-- Activate the required bank with a RAS
-				DramAddress			<= Address(23 downto 11);			-- supply a 13 bit ROW address to Dram
-				BankAddress			<= Address(25 downto 24) ;			-- supply a 2 bit BANK address to dram
+				DramAddress			<= MappedRow ;							-- supply a 13 bit ROW address to Dram
+				BankAddress			<= MappedBank ;						-- supply a 2 bit BANK address to dram
+				StateTimerLoad_H	<= '1';									-- time tRCD before the read/write command
 				
-				if(WE_L = '1')	then											-- if it is a read then issue CAS (but wait for 1 clock to meet 18ns min time between activate and read/write command)
+				if(WE_L = '1')	then											-- if it is a read then issue CAS (but wait tRCD between activate and read/write command)
+					StateTimerValue	<= conv_std_logic_vector(TrcdWait, 4) ;
 					NextState 		<= IssueCASWait1 ;
 				else
+					StateTimerValue	<= conv_std_logic_vector(TrcdWriteWait, 4) ;
 					NextState 		<= WaitForDataStrobes;				-- otherwise assume write and wait for data strobes before issueing CAS/WE to dram
 				end if ;
+
+			elsif (BulkRequest_H = '1') then								-- bulk master wants a transfer (new, or carrying on after a pause)
+				BulkStart_H			<= not BulkInProgress_H ;
+				StateTimerLoad_H	<= '1';
+				StateTimerValue	<= conv_std_logic_vector(TwrClocks + TrpClocks, 4) ;		-- last 68k write's auto precharge
+				NextState			<= BulkStart ;
 			else
 				NextState 			<= IDLE ;
 			end if ;		
@@ -423,19 +622,16 @@ Begin
 -- States associated with Memory Reads
 --------------------------------------------------------------------------------------------------------------------------------------------
 ----------------------------------------------------------------------------------------------------------------------------------
--- Wait at least 18ns after ACTIVATE command before issuing READ command, i.e. at least 3 clocks at 90Mhz to allow a margin of skew timing
+-- Wait at least tRCD after ACTIVATE command before issuing READ command, i.e. 3 clocks at 90Mhz to allow a margin of skew timing
 ----------------------------------------------------------------------------------------------------------------------------------
-		elsif(CurrentState = IssueCASWait1) then										-- enter here when it is a read cycle, or if it is a (data strobes have already been asserted)
-			Command 					<= NOP ;
-			CPUReset_L 				<= '1' ;
-			
-			NextState 				<= IssueCASWait2 ;	
-			
-		elsif(CurrentState = IssueCASWait2) then										-- enter here when it is a read cycle, or if it is a (data strobes have already been asserted)
+		elsif(CurrentState = IssueCASWait1) then										-- enter here when it is a read cycle, state timer counts down tRCD
 			Command 					<= NOP ;
 			CPUReset_L 				<= '1' ;
 			
-			NextState 				<= IssueCASWait3 ;				
+			NextState 				<= IssueCASWait1 ;	
+			if(StateTimerDone_H = '1') then
+				NextState 			<= IssueCASWait3 ;
+			end if ;
 			
 		elsif(CurrentState = IssueCASWait3) then									-- enter here when it is a read cycle, or if it is a (data strobes have already been asserted)
 			Command 					<= ReadAutoPrecharge ;						-- MUST be a read cycle so issue read with pre-charge command
@@ -443,16 +639,16 @@ Begin
 
 			--	No Dtack Yet
 			DramAddress 			<= "001" & Address(10 downto 1) ;		-- issue a 10 bit COLUMN address and set A10 on sdram = 1 to be a precharge command
-			BankAddress				<= Address(25 downto 24) ;					-- supply a 2 bit BANK address
+			BankAddress				<= MappedBank ;								-- supply a 2 bit BANK address
 			
-			TimerLoad_H 			<= '1' ;											-- start the timer for 2 clock cycle CAS LATENCY
-			TimerValue 				<= "0000000000000010" ;					
+			TimerLoad_H 			<= '1' ;											-- start the timer for the CAS LATENCY
+			TimerValue 				<= conv_std_logic_vector(CASLatency, 16) ;
 			
 			NextState 				<= DramReadWait ;		
 
 -- wait 2 clocks for 1st item of data
 			
-		elsif(CurrentState = DramReadWait) then				-- waiting for CAS latency to expire (2 clock cycles)
+		elsif(CurrentState = DramReadWait) then				-- waiting for CAS latency to expire (CASLatency clock cycles)
 			Command 					<= NOP ;							-- issue NOP while waiting
 			CPUReset_L 				<= '1' ;							-- no CPU reset
 			
@@ -465,21 +661,23 @@ Begin
     		end if ;
     	
 --------------------------------------------------------------------------------------------------------------------------------------------
--- State associated with issuing CAS during Memory Write: Has to be at least 18ns between ACTIVATE and WRITE commands i.e. 3clocks at 90Mhz
+-- State associated with issuing CAS during Memory Write: Has to be at least tRCD between ACTIVATE and WRITE commands
 --------------------------------------------------------------------------------------------------------------------------------------------
 		elsif(CurrentState = WaitForDataStrobes) then	 					-- ONLY end up here if 68k is writing to dram
 			CPUReset_L  			<= '1' ;											-- no CPU reset
 			Command 					<= NOP ;											-- issue NOP's to the Dram
 			
 			-- wait for 68k to decide/indicate the width of the data write upper or lower byte or 16 bit word (i.e both bytes)
+			-- and for tRCD to have passed since the activate
 			
-			if( UDS_L = '0' or LDS_L = '0') then								-- we have to wait for either data strobes (or both) to go low before issuing CAS/WE
+			if((UDS_L = '0' or LDS_L = '0') and StateTimerDone_H = '1') then	-- we have to wait for either data strobes (or both) to go low before issuing CAS/WE
 				Command 				<= WriteAutoPrecharge ;						-- issue the write
 				CPU_Dtack_L 		<= '0' ;											-- issue a dtack immediately for a write with no wait states
 				FPGAWritingtoSDram_H <= '1'	;									-- assume a write to sdram so turn on FPGA output buffers to drive data into SDRam
 				SDRamWriteData 	<= DataIn ;										-- present 68000 data out to dram data pins
+				DramDQM				<= UDS_L & LDS_L ;								-- mask the byte the 68000 is not writing
 				DramAddress 		<= "001" & Address(10 downto 1) ;		-- issue a 10 bit COLUMN address and set A10 on sdram = 1 to be a precharge command
-				BankAddress			<= Address(25 downto 24) ;					-- supply a 2 bit BANK address
+				BankAddress			<= MappedBank ;								-- supply a 2 bit BANK address
 				NextState 			<= DramWriteWait ;							-- wait for the dram 30ns after write command before next activate command
 			else
 				NextState 			<= WaitForDataStrobes ;						-- otherwise stay here until 68000 data strobes activate, cannot issue write to dram until then
@@ -494,6 +692,131 @@ Begin
 			SDRamWriteData 			<= DataIn ;
    		NextState 					<= Acknowledge ;							-- got data wait time Trp (20ns) so 1 state at 20ns per state (@50Mhz)
     		
+--------------------------------------------------------------------------------------------------------------------------------------------
+-- States associated with the bulk transfer port
+--------------------------------------------------------------------------------------------------------------------------------------------
+
+		elsif(CurrentState = BulkStart) then										-- all banks idle before the mode register is changed
+			Command 					<= NOP ;
+			CPUReset_L 				<= '1' ;
+			NextState 				<= BulkStart ;
+
+			if(StateTimerDone_H = '1') then
+				NextState 			<= BulkModeRegister ;
+			end if ;
+
+		elsif(CurrentState = BulkModeRegister) then
+			Command 					<= ModeRegisterSet ;
+			CPUReset_L 				<= '1' ;
+			DramAddress 			<= BulkModeWord ;								-- full page burst reads and writes
+			NextState 				<= BulkModeRegisterNOP ;
+
+		elsif(CurrentState = BulkModeRegisterNOP) then							-- tMRD
+			Command 					<= NOP ;
+			CPUReset_L 				<= '1' ;
+			NextState 				<= BulkActivate ;
+
+		elsif(CurrentState = BulkActivate) then
+			Command 					<= BankActivate ;
+			CPUReset_L 				<= '1' ;
+			DramAddress				<= BulkRow ;
+			BankAddress				<= BulkBank ;
+			StateTimerLoad_H		<= '1';											-- time tRCD before the first read/write
+			StateTimerValue		<= conv_std_logic_vector(TrcdWriteWait, 4) ;
+
+			if(BulkWrite_H = '1') then
+				NextState 			<= BulkWriteBurst ;
+			else
+				NextState 			<= BulkReadBurst ;
+			end if ;
+
+-- one word per clock while the master is ready. A read/write command (re)starts the burst at the next column,
+-- after that the SDRAM steps through the row by itself until a BurstStop. The 68k, a refresh, or the end of the
+-- transfer stop the burst without starting another, so no read/write is issued while the cache controller is
+-- waiting for its own CAS
+
+		elsif(CurrentState = BulkReadBurst or CurrentState = BulkWriteBurst) then
+			Command 					<= NOP ;
+			CPUReset_L 				<= '1' ;
+			NextState 				<= CurrentState ;
+
+			if(BulkCount = BulkLength or CpuRequest_H = '1' or RefreshTimerDone_H = '1') then
+				if(BulkRunning_H = '1') then
+					Command 			<= BurstStop ;
+					BulkBurstOff_H <= '1' ;
+				end if ;
+				StateTimerLoad_H	<= '1';
+				StateTimerValue	<= conv_std_logic_vector(BulkStopWait, 4) ;
+				NextState 			<= BulkStopped ;
+
+			elsif(BulkReady_H = '1' and StateTimerDone_H = '1') then
+				BulkWord_H			<= '1' ;
+
+				if(BulkRunning_H = '0') then
+					if(CurrentState = BulkWriteBurst) then
+						Command 		<= WriteOnly ;
+					else
+						Command 		<= ReadOnly ;
+					end if ;
+					DramAddress 	<= "000" & BulkColumn ;					-- A10 = 0, no auto precharge with full page bursts
+					BankAddress		<= BulkBank ;
+					BulkBurstOn_H 	<= '1' ;
+				end if ;
+
+				if(CurrentState = BulkWriteBurst) then
+					FPGAWritingtoSDram_H <= '1' ;
+					SDramWriteData	<= BulkDataIn ;
+					BulkTake_H		<= '1' ;
+				end if ;
+
+			elsif(BulkRunning_H = '1') then										-- master not ready, stop the burst until it is
+				Command 				<= BurstStop ;
+				BulkBurstOff_H 	<= '1' ;
+			end if ;
+
+		elsif(CurrentState = BulkStopped) then										-- wait for read words still on their way, tWR and tRAS
+			Command 					<= NOP ;
+			CPUReset_L 				<= '1' ;
+			NextState 				<= BulkStopped ;
+
+			if(StateTimerDone_H = '1' and BulkValidPipe = "0000") then
+				NextState 			<= BulkPrecharge ;
+			end if ;
+
+		elsif(CurrentState = BulkPrecharge) then
+			Command 					<= PrechargeSelectBank ;
+			CPUReset_L 				<= '1' ;
+			DramAddress				<= "0000000000000" ;							-- A10 = 0, this bank only
+			BankAddress				<= BulkBank ;
+			StateTimerLoad_H		<= '1';
+			StateTimerValue		<= conv_std_logic_vector(TrpWait, 4) ;
+			NextState 				<= BulkPrechargeWait ;
+
+		elsif(CurrentState = BulkPrechargeWait) then
+			Command 					<= NOP ;
+			CPUReset_L 				<= '1' ;
+			NextState 				<= BulkPrechargeWait ;
+
+			if(StateTimerDone_H = '1') then
+				NextState 			<= BulkRestoreModeRegister ;
+			end if ;
+
+		elsif(CurrentState = BulkRestoreModeRegister) then
+			Command 					<= ModeRegisterSet ;
+			CPUReset_L 				<= '1' ;
+			DramAddress 			<= CacheModeWord ;
+			NextState 				<= BulkRestoreNOP ;
+
+		elsif(CurrentState = BulkRestoreNOP) then									-- tMRD, then tell the master if it is all done
+			Command 					<= NOP ;
+			CPUReset_L 				<= '1' ;
+
+			if(BulkCount = BulkLength) then
+				BulkDone_H 			<= '1' ;
+				BulkFinish_H 		<= '1' ;
+			end if ;
+			NextState 				<= IDLE ;
+
 --------------------------------------------------------------------------------------------------------------------------------------------
 -- States associated with Memory Access Termination
 --------------------------------------------------------------------------------------------------------------------------------------------